@@ -6,12 +6,132 @@
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <utility>
 
+#include "viewer/parallel_for.h"
+#include "viewer/select_records.h"
+#include "viewer/thread_pool.h"
+
 namespace oko {
 
-AppModel::AppModel(std::vector<std::unique_ptr<LogFile>> files)
-    : files_(std::move(files)) {
+namespace {
+
+// Number of records, checked by one search task.
+const size_t kSearchChunkSize = 64 * 1024;
+// Searches, that finish during this time, select found record at once,
+// without waiting for next |Update| call.
+const auto kSyncSearchTimeout = std::chrono::milliseconds(100);
+
+// Returns index of the first (if |forward| is true) or last record in
+// range [begin, end) of |records|, for which |predicate(store_index)|
+// returns true. Range is split on chunks, checked on several threads.
+template<typename Predicate>
+std::optional<size_t> FindNearestRecord(
+    const RecordsAccessor& records,
+    size_t begin,
+    size_t end,
+    bool forward,
+    const Predicate& predicate,
+    const std::atomic<bool>& cancelled) noexcept {
+  // Chunks are numbered in search direction, so chunk with smaller
+  // number contains records nearer to the start of the search.
+  const size_t chunks_count =
+      (end - begin + kSearchChunkSize - 1) / kSearchChunkSize;
+  std::vector<size_t> chunk_results(chunks_count);
+  std::atomic<size_t> next_chunk = 0;
+  std::atomic<size_t> nearest_found_chunk = chunks_count;
+  ParallelFor(
+      std::min(chunks_count, GetParallelism()),
+      [&](size_t) {
+        for (size_t chunk = next_chunk++;
+             chunk < nearest_found_chunk && !cancelled;
+             chunk = next_chunk++) {
+          const size_t offset = chunk * kSearchChunkSize;
+          const size_t size = std::min(kSearchChunkSize, end - begin - offset);
+          const size_t chunk_begin = forward ?
+              begin + offset : end - offset - size;
+          const size_t chunk_end = chunk_begin + size;
+          bool found = false;
+          auto visitor = [&](size_t index, size_t store_index) {
+            if (predicate(store_index)) {
+              chunk_results[chunk] = index;
+              found = true;
+            }
+            return found;
+          };
+          if (forward) {
+            records.ForEach(chunk_begin, chunk_end, visitor);
+          } else {
+            records.ForEachReversed(chunk_begin, chunk_end, visitor);
+          }
+          if (!found) {
+            continue;
+          }
+          size_t nearest = nearest_found_chunk;
+          while (chunk < nearest &&
+                 !nearest_found_chunk.compare_exchange_weak(nearest, chunk)) {
+          }
+        }
+      });
+  if (cancelled || nearest_found_chunk == chunks_count) {
+    return std::nullopt;
+  }
+  return chunk_results[nearest_found_chunk];
+}
+
+// Returns sorted indexes of |records|, which indexes in the underlying
+// store are in |store_hits|.
+std::vector<uint32_t> FindRecordsOfSelection(
+    const RecordsAccessor& records,
+    const RecordSelection& store_hits,
+    const std::atomic<bool>& cancelled) noexcept {
+  const size_t count = store_hits.size();
+  const size_t partitions_count = std::clamp<size_t>(
+      count / kMinSelectPartitionSize, 1, GetParallelism());
+  std::vector<std::vector<uint32_t>> partition_results(partitions_count);
+  ParallelFor(
+      partitions_count,
+      [&](size_t p) {
+        std::vector<uint32_t>& result = partition_results[p];
+        store_hits.ForEach(
+            count * p / partitions_count,
+            count * (p + 1) / partitions_count,
+            [&records, &result, &cancelled](size_t, size_t store_index) {
+              const size_t index = records.LowerBoundByStoreIndex(
+                  store_index);
+              if (index < records.size() &&
+                  records.store_index(index) == store_index) {
+                result.push_back(static_cast<uint32_t>(index));
+              }
+              return cancelled.load();
+            });
+      });
+  std::vector<uint32_t> result;
+  for (const std::vector<uint32_t>& partition_result : partition_results) {
+    result.insert(
+        result.end(), partition_result.begin(), partition_result.end());
+  }
+  return result;
+}
+
+}  // namespace
+
+AppModel::AppModel(
+    std::vector<std::unique_ptr<LogFile>> files,
+    bool build_text_index)
+    : files_(std::move(files)),
+      build_text_index_(build_text_index) {
+  CreateMerger();
+}
+
+AppModel::~AppModel() {
+  CancelSearch();
+  ResetSearchHits(false);
+  ResetTextIndex();
+}
+
+void AppModel::CreateMerger() noexcept {
   if (files_.size() > 1) {
     std::vector<LogView*> views(files_.size());
     std::transform(
@@ -25,7 +145,200 @@ AppModel::AppModel(std::vector<std::unique_ptr<LogFile>> files)
   }
 }
 
-AppModel::~AppModel() = default;
+bool AppModel::Update() noexcept {
+  UpdateSearch();
+  UpdateSearchHits();
+  std::vector<LogFile*> changed_files;
+  for (const auto& f : files_) {
+    if (f->has_published_records()) {
+      changed_files.push_back(f.get());
+    }
+  }
+  if (changed_files.empty()) {
+    UpdateTextIndex();
+    return false;
+  }
+  // Background tasks and views use records of files, so must be stopped
+  // before records are replaced. Search may use text index, so must be
+  // stopped first.
+  CancelSearch();
+  ResetTextIndex();
+  const size_t shown_count = active_view().GetRecords().size();
+  // Keep showing the newest records, if the last one is selected.
+  const bool select_last = shown_count > 0 &&
+      selected_record_ + 1 == shown_count;
+  FilterSetChangeInfo info = BeforeFilterSetChanged();
+  // Only changed records of files are merged and filtered again. Usually
+  // these are records, appended to followed files.
+  if (merger_) {
+    for (LogFile* f : changed_files) {
+      f->UpdateRecords();
+      // Removed and added records are passed to filters at once.
+      StoreChange change;
+      merger_->ReplaceRecords(*f, f->kept_records_count(), &change);
+      ChangeUnfilteredRecords(change);
+    }
+  } else {
+    LogFile* file = files_[0].get();
+    StoreChange change;
+    const size_t old_size = file->GetRecords().size();
+    file->UpdateRecords();
+    change.new_store_size = file->GetRecords().size();
+    for (size_t i = file->kept_records_count(); i < old_size; ++i) {
+      change.removed.push_back(static_cast<uint32_t>(i));
+    }
+    for (size_t i = file->kept_records_count();
+         i < change.new_store_size;
+         ++i) {
+      change.added.push_back(static_cast<uint32_t>(i));
+    }
+    ChangeUnfilteredRecords(change);
+  }
+  AfterFilterSetChanged(std::move(info));
+  const size_t new_shown_count = active_view().GetRecords().size();
+  if (select_last && new_shown_count > 0) {
+    SetSelectedRecord(new_shown_count - 1);
+  }
+  UpdateTextIndex();
+  return true;
+}
+
+void AppModel::AddFile(std::unique_ptr<LogFile> file) noexcept {
+  CancelSearch();
+  ResetTextIndex();
+  FilterSetChangeInfo info = BeforeFilterSetChanged();
+  file->UpdateRecords();
+  files_.emplace_back(std::move(file));
+  AddToMerger(*files_.back());
+  AfterFilterSetChanged(std::move(info));
+  UpdateTextIndex();
+}
+
+std::unique_ptr<LogFile> AppModel::RemoveFileOfSelectedRecord() noexcept {
+  const RecordsAccessor records = active_view().GetRecords();
+  if (!merger_ || files_.size() < 2 || records.empty()) {
+    return nullptr;
+  }
+  const RecordStore& store = records.store();
+  const RecordStore* source = store.sources()[
+      store.source_id(records.store_index(selected_record_))];
+  const auto it = std::find_if(
+      files_.begin(),
+      files_.end(),
+      [source](const std::unique_ptr<LogFile>& f) {
+        return &f->GetRecords().store() == source;
+      });
+  // Files, that are parsed now, can not be destroyed.
+  if (it == files_.end() || !(*it)->has_all_records()) {
+    return nullptr;
+  }
+  CancelSearch();
+  ResetTextIndex();
+  FilterSetChangeInfo info = BeforeFilterSetChanged();
+  RemoveFromMerger(source);
+  std::unique_ptr<LogFile> result = std::move(*it);
+  files_.erase(it);
+  AfterFilterSetChanged(std::move(info));
+  UpdateTextIndex();
+  return result;
+}
+
+void AppModel::AddToMerger(const LogView& view) noexcept {
+  if (!merger_) {
+    // Records of the first file keep their indexes in merged view.
+    merger_ = std::make_unique<MergedLogView>(
+        std::vector<LogView*>{files_[0].get()});
+  }
+  StoreChange change;
+  merger_->AddRecords(view, 0, &change.added);
+  change.new_store_size = merger_->GetRecords().size();
+  ChangeUnfilteredRecords(change);
+}
+
+void AppModel::RemoveFromMerger(const RecordStore* store) noexcept {
+  StoreChange change;
+  merger_->RemoveRecords(store, 0, &change.removed);
+  change.new_store_size = merger_->GetRecords().size();
+  ChangeUnfilteredRecords(change);
+}
+
+void AppModel::ChangeUnfilteredRecords(const StoreChange& change) noexcept {
+  const LogView* parent_view = &unfiltered_view();
+  for (auto& filter : active_filters_) {
+    filter = filter->CloneForChangedView(parent_view, change);
+    parent_view = filter.get();
+  }
+  if (store_search_hits_) {
+    const RecordsAccessor records = unfiltered_view().GetRecords();
+    const RecordStore& store = records.store();
+    store_search_hits_ = store_search_hits_->ApplyChange(
+        change,
+        SelectAddedRecords(
+            records,
+            change.added,
+            [this, &store](size_t store_index) {
+              return search_matcher_.Matches(store.message(store_index));
+            }));
+  }
+}
+
+void AppModel::UpdateTextIndex() noexcept {
+  // Index of followed files would be built again after every appended
+  // record, so it is not built at all.
+  if (!build_text_index_ || text_index_ || is_parsing() || is_following()) {
+    return;
+  }
+  if (text_index_async_.valid()) {
+    if (text_index_async_.wait_for(std::chrono::seconds(0)) ==
+            std::future_status::ready) {
+      text_index_ = text_index_async_.get();
+    }
+    return;
+  }
+  const RecordStore* store = &unfiltered_view().GetRecords().store();
+  // Index can be persisted only for single file in cache, with records
+  // from persisted log index.
+  std::filesystem::path log_file_path, index_file_path;
+  uint64_t log_index_id = 0;
+  if (files_.size() == 1 && files_[0]->index_id() != 0) {
+    log_file_path = files_[0]->file_path();
+    index_file_path = TrigramIndex::PathForLogIndexFile(
+        files_[0]->index_file_path());
+    log_index_id = files_[0]->index_id();
+  }
+  // Index only speeds up other work, so it must not slow it down.
+  text_index_async_ = ThreadPool::instance().Submit(
+      TaskPriority::kBackground,
+      [store, log_file_path, index_file_path, log_index_id, this] {
+        auto result = std::make_unique<TrigramIndex>();
+        if (!index_file_path.empty() &&
+            !TrigramIndex::Read(
+                index_file_path,
+                log_file_path,
+                log_index_id,
+                store->size(),
+                result.get())) {
+          return result;
+        }
+        *result = TrigramIndex::Build(*store, cancel_text_index_);
+        if (!index_file_path.empty() && !cancel_text_index_) {
+          // Failure to write index is not fatal - it will be just built
+          // again next time.
+          result->Write(index_file_path, log_file_path, log_index_id);
+        }
+        return result;
+      });
+}
+
+void AppModel::ResetTextIndex() noexcept {
+  if (text_index_async_.valid()) {
+    cancel_text_index_ = true;
+    text_index_async_.wait();
+    text_index_async_ = {};
+    cancel_text_index_ = false;
+  }
+  text_index_.reset();
+}
 
 void AppModel::AppendFilter(std::unique_ptr<LogFilter> new_filter) noexcept {
   FilterSetChangeInfo info = BeforeFilterSetChanged();
@@ -52,23 +365,28 @@ void AppModel::RemoveLastFilter() noexcept {
 }
 
 AppModel::FilterSetChangeInfo AppModel::BeforeFilterSetChanged() noexcept {
-  const auto& records = active_view().GetRecords();
+  // Found record indexes would be meaningless for new set of records.
+  CancelSearch();
+  ResetSearchHits(true);
+  const RecordsAccessor records = active_view().GetRecords();
   if (records.empty()) {
     return {};
   }
   AppModel::FilterSetChangeInfo result;
   if (marked_records_begin_ != marked_records_end_) {
-    result.first_marked_record_ts = records[marked_records_begin_].timestamp();
-    result.last_marked_record_ts = records[
-        marked_records_end_ - 1].timestamp();
+    result.first_marked_record_ts = records.timestamp(
+        marked_records_begin_);
+    result.last_marked_record_ts = records.timestamp(
+        marked_records_end_ - 1);
   }
-  result.selected_record_ts = records[selected_record_].timestamp();
+  result.selected_record_ts = records.timestamp(selected_record_);
   return result;
 }
 
 void AppModel::AfterFilterSetChanged(FilterSetChangeInfo info) noexcept {
   sig_filter_set_changed_(active_filters_);
-  const auto& records = active_view().GetRecords();
+  StartFindSearchHits();
+  const RecordsAccessor records = active_view().GetRecords();
   if (records.empty()) {
     return;
   }
@@ -76,7 +394,7 @@ void AppModel::AfterFilterSetChanged(FilterSetChangeInfo info) noexcept {
   if (info.first_marked_record_ts && info.last_marked_record_ts) {
     marked_records_begin_ = GetIndexTimestampLessThenOrEqual(
         *info.first_marked_record_ts);
-    if (records[marked_records_begin_].timestamp() <
+    if (records.timestamp(marked_records_begin_) <
           *info.first_marked_record_ts) {
       // First marked record in region disappeared.
       // Make region smaller, not wider.
@@ -101,7 +419,7 @@ void AppModel::SetMarkedRegion(
 }
 
 void AppModel::SetSelectedRecord(size_t index) noexcept {
-  const auto& records = active_view().GetRecords();
+  const RecordsAccessor records = active_view().GetRecords();
   if (records.empty()) {
     return;
   }
@@ -111,7 +429,7 @@ void AppModel::SetSelectedRecord(size_t index) noexcept {
 }
 
 void AppModel::TrySelectNextRecord() noexcept {
-  const auto& records = active_view().GetRecords();
+  const RecordsAccessor records = active_view().GetRecords();
   if (selected_record_ + 1 < records.size()) {
     SetSelectedRecord(selected_record_ + 1);
   }
@@ -124,37 +442,31 @@ void AppModel::TrySelectPrevRecord() noexcept {
 }
 
 LogRecord::time_point AppModel::GetSelectedRecordTimestamp() const noexcept {
-  const auto& records = active_view().GetRecords();
+  const RecordsAccessor records = active_view().GetRecords();
   if (records.empty()) {
     return LogRecord::time_point{};
   }
-  return records[selected_record_].timestamp();
+  return records.timestamp(selected_record_);
 }
 
 size_t AppModel::GetIndexTimestampLessThenOrEqual(
     LogRecord::time_point tp) noexcept {
-  const auto& records = active_view().GetRecords();
+  const RecordsAccessor records = active_view().GetRecords();
   if (records.empty()) {
     return 0;
   }
-  auto it = std::lower_bound(
-      records.begin(),
-      records.end(),
-      tp,
-      [](const LogRecord& first, const LogRecord::time_point second) {
-        return first.timestamp() < second;
-      });
-  if (it == records.end()) {
+  size_t index = records.LowerBound(tp);
+  if (index == records.size()) {
     // Out of range - return last record.
     return records.size() - 1;
   } else {
-    if (it != records.begin() && it->timestamp() > tp) {
+    if (index != 0 && records.timestamp(index) > tp) {
       // Select last record with timestamp less then or equal to provided
       // by user.
-      --it;
+      --index;
     }
   }
-  return it - records.begin();
+  return index;
 }
 
 void AppModel::SelectRecordByTimestamp(LogRecord::time_point tp) noexcept {
@@ -162,62 +474,163 @@ void AppModel::SelectRecordByTimestamp(LogRecord::time_point tp) noexcept {
 }
 
 void AppModel::SearchForMessage(std::string text) noexcept {
-  search_text_ = std::move(text);
-  const auto& records = active_view().GetRecords();
-  if (records.empty() || search_text_.empty()) {
+  ResetSearchHits(false);
+  search_matcher_ = SubstringMatcher(std::move(text));
+  StartSearch(selected_record_, active_view().GetRecords().size(), true);
+  StartFindSearchHits();
+}
+
+void AppModel::SearchNextEntry() noexcept {
+  if (!search_hits_) {
+    StartSearch(
+        selected_record_ + 1, active_view().GetRecords().size(), true);
     return;
   }
-  auto it = std::find_if(
-      records.begin() + selected_record_,
-      records.end(),
-      [&txt = search_text_](const LogRecord& r) {
-        return r.message().find(txt) != std::string_view::npos;
-      });
-  if (it != records.end()) {
-    SetSelectedRecord(it - records.begin());
+  const auto it = std::upper_bound(
+      search_hits_->begin(), search_hits_->end(), selected_record_);
+  if (it != search_hits_->end()) {
+    SetSelectedRecord(*it);
   }
 }
 
-void AppModel::SearchNextEntry() noexcept {
-  const auto& records = active_view().GetRecords();
-  if (records.empty() || search_text_.empty()) {
+void AppModel::SearchPrevEntry() noexcept {
+  if (!search_hits_) {
+    StartSearch(0, selected_record_, false);
     return;
   }
-  if (selected_record_ + 1 >= records.size()) {
-    // Already at last record.
-    return;
+  const auto it = std::lower_bound(
+      search_hits_->begin(), search_hits_->end(), selected_record_);
+  if (it != search_hits_->begin()) {
+    SetSelectedRecord(*(it - 1));
   }
+}
 
-  auto it = std::find_if(
-      records.begin() + selected_record_ + 1,
-      records.end(),
-      [&txt = search_text_](const LogRecord& r) {
-        return r.message().find(txt) != std::string_view::npos;
-      });
-  if (it != records.end()) {
-    SetSelectedRecord(it - records.begin());
+void AppModel::SelectSearchHit(size_t hit_index) noexcept {
+  if (search_hits_ && hit_index < search_hits_->size()) {
+    CancelSearch();
+    SetSelectedRecord((*search_hits_)[hit_index]);
   }
 }
 
-void AppModel::SearchPrevEntry() noexcept {
-  const auto& records = active_view().GetRecords();
-  if (records.empty() || search_text_.empty()) {
+void AppModel::StartFindSearchHits() noexcept {
+  if (search_matcher_.pattern().empty()) {
     return;
   }
-  if (selected_record_ == 0) {
-    // Already at first record.
+  const RecordsAccessor unfiltered_records = unfiltered_view().GetRecords();
+  search_hits_async_ = ThreadPool::instance().Submit(
+      TaskPriority::kInteractive,
+      [unfiltered_records,
+       records = active_view().GetRecords(),
+       store_hits = store_search_hits_ ? &*store_search_hits_ : nullptr,
+       matcher = search_matcher_,
+       text_index = FindTextIndex(unfiltered_records),
+       this]() mutable {
+        SearchHits result;
+        if (!store_hits) {
+          const TrigramIndex::Candidates candidates = text_index ?
+              text_index->FindCandidates(matcher.pattern()) :
+              TrigramIndex::Candidates();
+          const RecordStore& store = unfiltered_records.store();
+          result.store_hits = SelectRecords(
+              unfiltered_records,
+              [&candidates, &matcher, &store](size_t store_index) {
+                return candidates.MayContain(store_index) &&
+                    matcher.Matches(store.message(store_index));
+              },
+              &cancel_search_hits_,
+              nullptr);
+          store_hits = &*result.store_hits;
+        }
+        result.view_hits = FindRecordsOfSelection(
+            records, *store_hits, cancel_search_hits_);
+        return result;
+      });
+}
+
+void AppModel::UpdateSearchHits() noexcept {
+  if (!search_hits_async_.valid() ||
+      search_hits_async_.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
     return;
   }
+  SearchHits result = search_hits_async_.get();
+  if (result.store_hits) {
+    store_search_hits_ = std::move(result.store_hits);
+  }
+  search_hits_ = std::move(result.view_hits);
+}
+
+void AppModel::ResetSearchHits(bool keep_store_hits) noexcept {
+  if (search_hits_async_.valid()) {
+    cancel_search_hits_ = true;
+    search_hits_async_.wait();
+    search_hits_async_ = {};
+    cancel_search_hits_ = false;
+  }
+  search_hits_ = std::nullopt;
+  if (!keep_store_hits) {
+    store_search_hits_ = std::nullopt;
+  }
+}
 
-  auto it = std::find_if(
-      std::make_reverse_iterator(records.begin() + selected_record_),
-      records.rend(),
-      [&txt = search_text_](const LogRecord& r) {
-        return r.message().find(txt) != std::string_view::npos;
+void AppModel::StartSearch(size_t begin, size_t end, bool forward) noexcept {
+  CancelSearch();
+  const RecordsAccessor records = active_view().GetRecords();
+  if (begin >= end || search_matcher_.pattern().empty()) {
+    return;
+  }
+  search_async_ = ThreadPool::instance().Submit(
+      TaskPriority::kInteractive,
+      [records, begin, end, forward,
+       matcher = search_matcher_,
+       text_index = FindTextIndex(records),
+       this] {
+        const TrigramIndex::Candidates candidates = text_index ?
+            text_index->FindCandidates(matcher.pattern()) :
+            TrigramIndex::Candidates();
+        const RecordStore& store = records.store();
+        return FindNearestRecord(
+            records, begin, end, forward,
+            [&candidates, &matcher, &store](size_t store_index) {
+              return candidates.MayContain(store_index) &&
+                  matcher.Matches(store.message(store_index));
+            },
+            cancel_search_);
       });
-  if (it != records.rend()) {
-    SetSelectedRecord(it.base() - records.begin() - 1);
+  if (search_async_.wait_for(kSyncSearchTimeout) ==
+          std::future_status::ready) {
+    UpdateSearch();
+  }
+}
+
+void AppModel::UpdateSearch() noexcept {
+  if (!search_async_.valid() ||
+      search_async_.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready) {
+    return;
+  }
+  const std::optional<size_t> found_index = search_async_.get();
+  if (found_index) {
+    SetSelectedRecord(*found_index);
+  }
+}
+
+void AppModel::CancelSearch() noexcept {
+  if (search_async_.valid()) {
+    cancel_search_ = true;
+    search_async_.wait();
+    search_async_ = {};
+    cancel_search_ = false;
+  }
+}
+
+const TrigramIndex* AppModel::FindTextIndex(
+    const RecordsAccessor& records) const noexcept {
+  if (!text_index_ ||
+      text_index_->records_count() != records.store().size()) {
+    return nullptr;
   }
+  return text_index_.get();
 }
 
 }  // namespace oko
@@ -4,6 +4,8 @@
 
 #pragma once
 #include <algorithm>
+#include <atomic>
+#include <future>
 #include <optional>
 #include <memory>
 #include <string>
@@ -14,18 +16,83 @@
 #include "viewer/log_file.h"
 #include "viewer/log_filter.h"
 #include "viewer/merged_log_view.h"
+#include "viewer/substring_matcher.h"
+#include "viewer/trigram_index.h"
 
 namespace oko {
 
 class AppModel {
  public:
-  explicit AppModel(std::vector<std::unique_ptr<oko::LogFile>> files);
+  // |files| may be not completely parsed yet, see |Update|.
+  // If |build_text_index| is true, text index of all records is built
+  // in background after parsing finishes, to speed up pattern filters
+  // and search.
+  AppModel(
+      std::vector<std::unique_ptr<oko::LogFile>> files,
+      bool build_text_index);
   ~AppModel();
 
+  // Shows records, published by files since last call. Filters are
+  // re-applied to new records. Returns true if shown records changed.
+  // Also picks up text index and search results, when they are ready.
+  bool Update() noexcept;
+
+  // Adds |file| to shown ones. File may be not completely parsed yet,
+  // see |Update|. Only records of |file| are merged and filtered.
+  void AddFile(std::unique_ptr<LogFile> file) noexcept;
+  // Removes file, that contains selected record, and returns it. Returns
+  // nullptr if file can not be removed - it is the only file or it is
+  // still parsed.
+  std::unique_ptr<LogFile> RemoveFileOfSelectedRecord() noexcept;
+
+  // Returns text index of all unfiltered records, or nullptr if it is not
+  // built yet.
+  const TrigramIndex* text_index() const noexcept {
+    return text_index_.get();
+  }
+
+  // Returns true if text index is being built now.
+  bool is_indexing() const noexcept {
+    return text_index_async_.valid();
+  }
+
+  // Returns true if some files still may publish more records.
+  bool is_parsing() const noexcept {
+    return std::any_of(
+        files_.begin(),
+        files_.end(),
+        [](const std::unique_ptr<LogFile>& f) {
+          return !f->has_all_records();
+        });
+  }
+
+  // Returns true if records may be appended to some files.
+  bool is_following() const noexcept {
+    return std::any_of(
+        files_.begin(),
+        files_.end(),
+        [](const std::unique_ptr<LogFile>& f) {
+          return f->is_followed();
+        });
+  }
+
+  size_t parsed_records_count() const noexcept {
+    size_t result = 0;
+    for (const auto& f : files_) {
+      result += f->parsed_records_count();
+    }
+    return result;
+  }
+
   const LogView& active_view() const noexcept {
     if (!active_filters_.empty()) {
       return *active_filters_.back();
-    } else if (merger_) {
+    }
+    return unfiltered_view();
+  }
+
+  const LogView& unfiltered_view() const noexcept {
+    if (merger_) {
       return *merger_;
     } else {
       return *files_[0];
@@ -33,11 +100,7 @@ class AppModel {
   }
 
   size_t unfiltered_records_count() const noexcept {
-    if (merger_) {
-      return merger_->GetRecords().size();
-    } else {
-      return files_[0]->GetRecords().size();
-    }
+    return unfiltered_view().GetRecords().size();
   }
 
   size_t marked_records_count() const noexcept {
@@ -81,12 +144,52 @@ class AppModel {
   void TrySelectNextRecord() noexcept;
   void TrySelectPrevRecord() noexcept;
 
+  // Search functions select the nearest record, that contains search text.
+  // Until search hits are known (see |has_search_hits|), record is found
+  // in background and selected during one of following |Update| calls.
   void SearchForMessage(std::string text) noexcept;
   void SearchNextEntry() noexcept;
   void SearchPrevEntry() noexcept;
+  void CancelSearch() noexcept;
+
+  bool is_searching() const noexcept {
+    return search_async_.valid();
+  }
+
+  // Returns true if all records of active view, that contain search text
+  // (search hits), are known.
+  bool has_search_hits() const noexcept {
+    return search_hits_.has_value();
+  }
+
+  bool is_finding_search_hits() const noexcept {
+    return search_hits_async_.valid();
+  }
+
+  size_t search_hits_count() const noexcept {
+    return search_hits_ ? search_hits_->size() : 0;
+  }
+
+  // Returns number of search hits at or before selected record.
+  size_t search_hits_up_to_selected() const noexcept {
+    if (!search_hits_) {
+      return 0;
+    }
+    return std::upper_bound(
+        search_hits_->begin(),
+        search_hits_->end(),
+        selected_record_) - search_hits_->begin();
+  }
+
+  // Selects search hit with index |hit_index|, counting from zero.
+  void SelectSearchHit(size_t hit_index) noexcept;
 
   const std::string& search_text() const noexcept {
-    return search_text_;
+    return search_matcher_.pattern();
+  }
+
+  const SubstringMatcher& search_matcher() const noexcept {
+    return search_matcher_;
   }
 
   size_t selected_record() const noexcept {
@@ -97,9 +200,9 @@ class AppModel {
     if (marked_records_end_ == marked_records_begin_) {
       return {};
     }
-    const auto& records = active_view().GetRecords();
-    return records[marked_records_end_ - 1].timestamp() -
-        records[marked_records_begin_].timestamp();
+    const RecordsAccessor records = active_view().GetRecords();
+    return records.timestamp(marked_records_end_ - 1) -
+        records.timestamp(marked_records_begin_);
   }
 
   using FilterSetChangedSignature = void (
@@ -129,9 +232,37 @@ class AppModel {
   FilterSetChangeInfo BeforeFilterSetChanged() noexcept;
   void AfterFilterSetChanged(FilterSetChangeInfo info) noexcept;
   size_t GetIndexTimestampLessThenOrEqual(LogRecord::time_point tp) noexcept;
+  void CreateMerger() noexcept;
+  // Merge all records of |view| into unfiltered ones.
+  void AddToMerger(const LogView& view) noexcept;
+  // Removes all records of |store| from unfiltered ones.
+  void RemoveFromMerger(const RecordStore* store) noexcept;
+  // Updates filters and search hits in unfiltered records after
+  // unfiltered records were changed by |change|. Only changed records
+  // are checked.
+  void ChangeUnfilteredRecords(const StoreChange& change) noexcept;
+  // Starts search for the nearest record in range [begin, end) of
+  // active view, that contains search text. Found record is selected
+  // by |UpdateSearch|.
+  void StartSearch(size_t begin, size_t end, bool forward) noexcept;
+  void UpdateSearch() noexcept;
+  // Starts finding all search hits of active view in background.
+  void StartFindSearchHits() noexcept;
+  void UpdateSearchHits() noexcept;
+  // Stops finding of search hits and drops hits of active view.
+  // Hits in unfiltered records are dropped only if |keep_store_hits|
+  // is false.
+  void ResetSearchHits(bool keep_store_hits) noexcept;
+  // Returns text index if it can be used for |records|.
+  const TrigramIndex* FindTextIndex(
+      const RecordsAccessor& records) const noexcept;
+  // Starts building of text index or picks up built one, if necessary.
+  void UpdateTextIndex() noexcept;
+  // Drops text index, e.g. when unfiltered records change.
+  void ResetTextIndex() noexcept;
 
-  const std::vector<std::unique_ptr<LogFile>> files_;
-  //  May be nullptr if |files_| have only one item.
+  std::vector<std::unique_ptr<LogFile>> files_;
+  // May be nullptr if only one file was shown since construction.
   std::unique_ptr<MergedLogView> merger_;
   std::vector<std::unique_ptr<LogFilter>> active_filters_;
   // Index of first marked record, inclusively.
@@ -140,7 +271,28 @@ class AppModel {
   size_t marked_records_end_ = 0;
   size_t selected_record_ = 0;
 
-  std::string search_text_;
+  SubstringMatcher search_matcher_;
+  std::future<std::optional<size_t>> search_async_;
+  std::atomic<bool> cancel_search_ = false;
+
+  struct SearchHits {
+    // Set only if they were not known when search started.
+    std::optional<RecordSelection> store_hits;
+    std::vector<uint32_t> view_hits;
+  };
+  // Unfiltered records, that contain search text. They are used to
+  // quickly find search hits of active view when filters change.
+  std::optional<RecordSelection> store_search_hits_;
+  // Sorted indexes of active view records, that contain search text.
+  std::optional<std::vector<uint32_t>> search_hits_;
+  std::future<SearchHits> search_hits_async_;
+  std::atomic<bool> cancel_search_hits_ = false;
+
+  const bool build_text_index_;
+  // Index of |unfiltered_view()| records. Built in |text_index_async_|.
+  std::unique_ptr<TrigramIndex> text_index_;
+  std::future<std::unique_ptr<TrigramIndex>> text_index_async_;
+  std::atomic<bool> cancel_text_index_ = false;
 
   boost::signals2::signal<FilterSetChangedSignature> sig_filter_set_changed_;
   boost::signals2::signal<SelectedRecordChangedSignature>
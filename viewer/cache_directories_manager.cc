@@ -4,13 +4,27 @@
 
 #include "viewer/cache_directories_manager.h"
 
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <xxhash.h>
+
 #include <boost/algorithm/hex.hpp>
+#include <boost/format.hpp>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/uuid/detail/sha1.hpp>
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <optional>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "viewer/error_codes.h"
+#include "viewer/parallel_for.h"
+#include "viewer/thread_pool.h"
 
 namespace oko {
 
@@ -18,6 +32,10 @@ namespace {
 
 using Hasher = boost::uuids::detail::sha1;
 
+// Blocks are hashed in parallel, and progress is reported after each
+// block.
+constexpr size_t kHashedBlockSize = 4 * 1024 * 1024;
+
 std::string DigestToString(Hasher::digest_type digest) noexcept {
   std::string result;
   boost::algorithm::hex(
@@ -35,26 +53,259 @@ std::string HashData(std::string_view data) noexcept {
   return DigestToString(digest);
 }
 
+// Fast non-cryptographic hash, that is used only for cache keys. Blocks
+// are hashed on several threads, then their hashes are hashed again.
+// Returns nullopt if |hashing| is cancelled.
+std::optional<std::string> FastHashData(
+    std::string_view data, ProgressStage* hashing) noexcept {
+  hashing->AddTotalBytes(data.size());
+  const size_t blocks_count =
+      (data.size() + kHashedBlockSize - 1) / kHashedBlockSize;
+  std::vector<XXH64_hash_t> block_hashes(blocks_count);
+  ParallelFor(blocks_count, [data, hashing, &block_hashes](size_t i) {
+    if (hashing->is_cancelled()) {
+      return;
+    }
+    const std::string_view block = data.substr(
+        i * kHashedBlockSize, kHashedBlockSize);
+    block_hashes[i] = XXH64(block.data(), block.size(), 0);
+    hashing->AddDoneBytes(block.size());
+  });
+  if (hashing->is_cancelled()) {
+    return std::nullopt;
+  }
+  const XXH64_hash_t digest = XXH64(
+      block_hashes.data(),
+      block_hashes.size() * sizeof(XXH64_hash_t),
+      data.size());
+  return boost::str(boost::format("%1$016x") % digest);
+}
+
 outcome::std_result<std::string> HashFile(
+    const std::filesystem::path& file_path, Progress* progress) noexcept {
+  std::error_code ec;
+  auto file_size = std::filesystem::file_size(file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  ProgressStage hashing(progress, Progress::Stage::kHashing);
+  // mapped_file constructor will throw on empty files.
+  if (file_size == 0) {
+    return *FastHashData(std::string_view(), &hashing);
+  }
+  boost::iostreams::mapped_file mapped_file(
+      file_path, boost::iostreams::mapped_file::readonly);
+  if (!mapped_file.is_open()) {
+    return ErrorCodes::kFailedMapFile;
+  }
+  std::optional<std::string> hash = FastHashData(
+      std::string_view(mapped_file.const_data(), mapped_file.size()),
+      &hashing);
+  if (!hash) {
+    return ErrorCodes::kCancelled;
+  }
+  return std::move(*hash);
+}
+
+// Returns key, that identifies contents of file by its metadata, so it
+// is computed without reading the file. Contents are considered changed,
+// if file is replaced, resized or modified. Returns nullopt if metadata
+// can not identify file.
+std::optional<std::string> FileMetadataKey(
     const std::filesystem::path& file_path) noexcept {
-  Hasher hash;
+  struct stat file_stat;
+  if (stat(file_path.c_str(), &file_stat) != 0) {
+    return std::nullopt;
+  }
+  // Some file systems do not provide inode numbers.
+  if (file_stat.st_ino == 0) {
+    return std::nullopt;
+  }
+  const uint64_t mtime_ns =
+      static_cast<uint64_t>(file_stat.st_mtim.tv_sec) * 1000000000 +
+      file_stat.st_mtim.tv_nsec;
+  return boost::str(boost::format("file:%1%:%2%:%3%:%4%") %
+      file_stat.st_dev %
+      file_stat.st_ino %
+      file_stat.st_size %
+      mtime_ns);
+}
+
+// Lock file inside each cache directory. Processes, that use directory,
+// hold shared lock of it, and evicting process takes exclusive one.
+// Modification time of the file is time of the last use of directory.
+constexpr char kLockFileName[] = ".lock";
+constexpr auto kLockPollInterval = std::chrono::milliseconds(50);
+// Directories without lock file are created by older versions, that did
+// not lock them, so such directory may be still used, if it was modified
+// recently.
+constexpr auto kUnlockedDirectoryGracePeriod = std::chrono::hours(24);
 
+// Removes temporary files, e.g. "index.tmp1234", left in cache directory
+// |dir_path| by crashed processes. Exclusive lock of the directory must be
+// held, so no process writes such files.
+void RemoveTemporaryFiles(const std::filesystem::path& dir_path) noexcept {
+  constexpr std::string_view kTmpSuffix = ".tmp";
+  std::vector<std::filesystem::path> tmp_file_paths;
   std::error_code ec;
-  auto file_size = std::filesystem::file_size(file_path, ec);
+  for (std::filesystem::recursive_directory_iterator it(dir_path, ec), end;
+       !ec && it != end;
+       it.increment(ec)) {
+    const std::string file_name = it->path().filename().native();
+    const size_t suffix_pos = file_name.rfind(kTmpSuffix);
+    if (suffix_pos != std::string::npos &&
+        std::all_of(
+            file_name.begin() + suffix_pos + kTmpSuffix.size(),
+            file_name.end(),
+            [](char c) {
+              return c >= '0' && c <= '9';
+            })) {
+      tmp_file_paths.push_back(it->path());
+    }
+  }
+  for (const std::filesystem::path& tmp_file_path : tmp_file_paths) {
+    std::filesystem::remove(tmp_file_path, ec);
+  }
+}
+
+// Takes shared lock of cache directory |dir_path|, creating it if needed,
+// and marks it used now. Returns descriptor of locked file. Temporary
+// files are removed, if no other process uses the directory.
+outcome::std_result<int> LockDirectory(
+    const std::filesystem::path& dir_path) noexcept {
+  const std::filesystem::path lock_file_path = dir_path / kLockFileName;
+  while (true) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir_path, ec);
+    if (ec) {
+      return ec;
+    }
+    const int fd = open(
+        lock_file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+      if (errno == ENOENT) {
+        // Directory was evicted after it was created.
+        continue;
+      }
+      return std::error_code(errno, std::generic_category());
+    }
+    struct stat locked_stat, current_stat;
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+      if (fstat(fd, &locked_stat) == 0 &&
+          stat(lock_file_path.c_str(), &current_stat) == 0 &&
+          current_stat.st_dev == locked_stat.st_dev &&
+          current_stat.st_ino == locked_stat.st_ino) {
+        RemoveTemporaryFiles(dir_path);
+      }
+      // Lock is converted to shared one, and checked again below, since
+      // conversion is not atomic.
+    }
+    if (flock(fd, LOCK_SH) != 0 || fstat(fd, &locked_stat) != 0) {
+      ec = std::error_code(errno, std::generic_category());
+      close(fd);
+      return ec;
+    }
+    // Evicting process removes directory while holding exclusive lock,
+    // so lock of removed file does not protect anything.
+    if (stat(lock_file_path.c_str(), &current_stat) == 0 &&
+        current_stat.st_dev == locked_stat.st_dev &&
+        current_stat.st_ino == locked_stat.st_ino) {
+      futimens(fd, nullptr);
+      return fd;
+    }
+    close(fd);
+  }
+}
+
+// Waits until exclusive lock of file |fd| is taken, or |progress| is
+// cancelled.
+std::error_code LockFileExclusively(
+    int fd, const Progress* progress) noexcept {
+  // Lock is polled, since waiting in |flock| can not be cancelled.
+  while (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+    if (errno != EWOULDBLOCK && errno != EINTR) {
+      return std::error_code(errno, std::generic_category());
+    }
+    if (progress && progress->is_cancelled()) {
+      return ErrorCodes::kCancelled;
+    }
+    std::this_thread::sleep_for(kLockPollInterval);
+  }
+  return std::error_code();
+}
+
+// Creates |file_path| with |create_file|, unless other process did it.
+// Exclusive lock of the file must be held.
+std::error_code CreateLockedFile(
+    const std::filesystem::path& file_path,
+    const CacheDirectoriesManager::CreateFileCallback& create_file,
+    bool* created) noexcept {
+  std::error_code ec;
+  if (std::filesystem::exists(file_path, ec) && !ec) {
+    *created = false;
+    return std::error_code();
+  }
+  // Temporary file is marker of creation in progress. Since lock is free,
+  // it is left by crashed or cancelled process.
+  std::filesystem::path tmp_file_path = file_path;
+  tmp_file_path.concat(".tmp");
+  std::filesystem::remove(tmp_file_path, ec);
+  ec = create_file(tmp_file_path);
   if (ec) {
+    std::error_code remove_ec;
+    std::filesystem::remove(tmp_file_path, remove_ec);
     return ec;
   }
-  if (file_size > 0) {
-    // mapped_file constructor will throw on empty files.
-    boost::iostreams::mapped_file mapped_file(file_path);
-    if (!mapped_file.is_open()) {
-      return ErrorCodes::kFailedMapFile;
+  std::filesystem::rename(tmp_file_path, file_path, ec);
+  *created = !ec;
+  return ec;
+}
+
+// Removes cache directory |dir_path|, if no process uses it. Lock file
+// is created only if |create_lock_file| is true, e.g. for directories of
+// older versions.
+bool TryEvictDirectory(
+    const std::filesystem::path& dir_path, bool create_lock_file) noexcept {
+  const std::filesystem::path lock_file_path = dir_path / kLockFileName;
+  const int fd = create_lock_file ?
+      open(lock_file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644) :
+      open(lock_file_path.c_str(), O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  bool removed = false;
+  struct stat locked_stat, current_stat;
+  // Lock file may be already removed with its directory by other
+  // process, and the directory may be created again and used, so the
+  // same check as in |LockDirectory| is needed.
+  if (flock(fd, LOCK_EX | LOCK_NB) == 0 &&
+      fstat(fd, &locked_stat) == 0 &&
+      stat(lock_file_path.c_str(), &current_stat) == 0 &&
+      current_stat.st_dev == locked_stat.st_dev &&
+      current_stat.st_ino == locked_stat.st_ino) {
+    std::error_code ec;
+    std::filesystem::remove_all(dir_path, ec);
+    removed = !ec;
+  }
+  close(fd);
+  return removed;
+}
+
+uint64_t GetDirectorySize(const std::filesystem::path& dir_path) noexcept {
+  uint64_t result = 0;
+  std::error_code ec;
+  for (std::filesystem::recursive_directory_iterator it(dir_path, ec), end;
+       !ec && it != end;
+       it.increment(ec)) {
+    std::error_code size_ec;
+    if (it->is_regular_file(size_ec)) {
+      const uint64_t file_size = it->file_size(size_ec);
+      if (!size_ec) {
+        result += file_size;
+      }
     }
-    hash.process_bytes(mapped_file.data(), mapped_file.size());
   }
-  Hasher::digest_type digest;
-  hash.get_digest(digest);
-  return DigestToString(digest);
+  return result;
 }
 
 std::filesystem::path GetHomeDir() noexcept {
@@ -68,10 +319,26 @@ std::filesystem::path GetHomeDir() noexcept {
 
 }  // namespace
 
-CacheDirectoriesManager::CacheDirectoriesManager() noexcept {
+CacheDirectoriesManager::CacheDirectoriesManager(uint64_t max_size) noexcept
+    : max_size_(max_size) {
   std::filesystem::path home_dir = GetHomeDir();
   if (!home_dir.empty()) {
     cache_root_path_ = home_dir / ".cache/oko";
+    // Cache may be left too large by previous sessions.
+    StartEviction();
+  }
+}
+
+CacheDirectoriesManager::~CacheDirectoriesManager() {
+  cancel_eviction_ = true;
+  {
+    std::lock_guard<std::mutex> lock(eviction_mutex_);
+    if (eviction_.valid()) {
+      eviction_.wait();
+    }
+  }
+  for (const auto& [path, fd] : locked_directories_) {
+    close(fd);
   }
 }
 
@@ -86,29 +353,188 @@ outcome::std_result<std::filesystem::path>
   assert(!cache_root_path_.empty());
   assert(!hash.empty());
   std::filesystem::path result = cache_root_path_ / hash;
-  std::error_code ec;
-  if (!std::filesystem::is_directory(result, ec) || ec) {
-    std::filesystem::create_directories(result, ec);
-    if (ec) {
-      return ec;
-    }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (locked_directories_.count(result.native()) != 0) {
+    return result;
+  }
+  outcome::std_result<int> maybe_fd = LockDirectory(result);
+  if (!maybe_fd) {
+    return maybe_fd.error();
   }
+  locked_directories_.emplace(result.native(), maybe_fd.value());
   return result;
 }
 
 outcome::std_result<std::filesystem::path>
     CacheDirectoriesManager::DirectoryForFile(
-        const std::filesystem::path& file_path) noexcept {
-  auto maybe_hash = HashFile(file_path);
+        const std::filesystem::path& file_path,
+        Progress* progress) noexcept {
+  if (std::optional<std::string> key = FileMetadataKey(file_path); key) {
+    return DirectoryForHash(HashData(*key));
+  }
+  auto maybe_hash = HashFile(file_path, progress);
   if (!maybe_hash) {
     return maybe_hash.error();
   }
   return DirectoryForHash(std::move(maybe_hash.value()));
 }
 
+bool CacheDirectoriesManager::ContainsPath(
+    const std::filesystem::path& path) const noexcept {
+  if (cache_root_path_.empty()) {
+    return false;
+  }
+  const std::filesystem::path relative_path =
+      path.lexically_normal().lexically_relative(cache_root_path_);
+  return !relative_path.empty() && *relative_path.begin() != "..";
+}
+
 outcome::std_result<std::filesystem::path>
     CacheDirectoriesManager::DirectoryForData(std::string_view data) noexcept {
-  return DirectoryForHash(HashData(data));
+  ProgressStage hashing(nullptr, Progress::Stage::kHashing);
+  return DirectoryForHash(*FastHashData(data, &hashing));
+}
+
+outcome::std_result<bool> CacheDirectoriesManager::GetOrCreateFile(
+    const std::filesystem::path& file_path,
+    const Progress* progress,
+    const CreateFileCallback& create_file) noexcept {
+  std::error_code ec;
+  if (std::filesystem::exists(file_path, ec) && !ec) {
+    ReportHit();
+    return false;
+  }
+  std::filesystem::create_directories(file_path.parent_path(), ec);
+  if (ec) {
+    return ec;
+  }
+  std::filesystem::path lock_file_path = file_path;
+  lock_file_path.concat(kLockFileName);
+  const int fd = open(
+      lock_file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  bool created = false;
+  ec = LockFileExclusively(fd, progress);
+  if (!ec) {
+    ec = CreateLockedFile(file_path, create_file, &created);
+  }
+  if (!ec) {
+    // Processes, that wait for lock of removed file, find created file
+    // after they take the lock.
+    unlink(lock_file_path.c_str());
+  }
+  // Releases lock.
+  close(fd);
+  if (ec) {
+    return ec;
+  }
+  if (created) {
+    const uint64_t file_size = std::filesystem::file_size(file_path, ec);
+    ReportMiss(ec ? 0 : file_size);
+  } else {
+    ReportHit();
+  }
+  return created;
+}
+
+void CacheDirectoriesManager::ReportHit() noexcept {
+  hits_count_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CacheDirectoriesManager::ReportMiss(uint64_t added_size) noexcept {
+  misses_count_.fetch_add(1, std::memory_order_relaxed);
+  if (estimated_size_.fetch_add(added_size) + added_size > max_size_) {
+    StartEviction();
+  }
+}
+
+CacheDirectoriesManager::Stats
+    CacheDirectoriesManager::GetStats() const noexcept {
+  return Stats{
+      hits_count_.load(std::memory_order_relaxed),
+      misses_count_.load(std::memory_order_relaxed),
+      evicted_directories_count_.load(std::memory_order_relaxed),
+      evicted_bytes_.load(std::memory_order_relaxed),
+      estimated_size_.load(),
+      max_size_,
+  };
+}
+
+void CacheDirectoriesManager::StartEviction() noexcept {
+  std::lock_guard<std::mutex> lock(eviction_mutex_);
+  if (cancel_eviction_ ||
+      (eviction_.valid() &&
+       eviction_.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready)) {
+    return;
+  }
+  eviction_ = ThreadPool::instance().Submit(
+      TaskPriority::kBackground,
+      [this] {
+        EvictDirectories();
+      });
+}
+
+void CacheDirectoriesManager::EvictDirectories() noexcept {
+  struct Directory {
+    std::filesystem::path path;
+    uint64_t size;
+    std::filesystem::file_time_type last_use_time;
+    bool has_lock_file;
+  };
+  std::vector<Directory> directories;
+  uint64_t total_size = 0;
+  const auto now = std::filesystem::file_time_type::clock::now();
+  std::error_code ec;
+  for (std::filesystem::directory_iterator it(cache_root_path_, ec), end;
+       !ec && it != end && !cancel_eviction_;
+       it.increment(ec)) {
+    std::error_code entry_ec;
+    if (!it->is_directory(entry_ec)) {
+      continue;
+    }
+    Directory dir;
+    dir.path = it->path();
+    dir.last_use_time = std::filesystem::last_write_time(
+        dir.path / kLockFileName, entry_ec);
+    dir.has_lock_file = !entry_ec;
+    if (!dir.has_lock_file) {
+      // Directory is being created by other process, or it is left by
+      // older version. Recently modified ones are neither removed nor
+      // counted, see |kUnlockedDirectoryGracePeriod|.
+      dir.last_use_time = std::filesystem::last_write_time(
+          dir.path, entry_ec);
+      if (entry_ec ||
+          now - dir.last_use_time < kUnlockedDirectoryGracePeriod) {
+        continue;
+      }
+    }
+    dir.size = GetDirectorySize(dir.path);
+    total_size += dir.size;
+    directories.push_back(std::move(dir));
+  }
+  if (ec || cancel_eviction_) {
+    return;
+  }
+  std::sort(
+      directories.begin(),
+      directories.end(),
+      [](const Directory& first, const Directory& second) {
+        return first.last_use_time < second.last_use_time;
+      });
+  for (const Directory& dir : directories) {
+    if (total_size <= max_size_ || cancel_eviction_) {
+      break;
+    }
+    if (TryEvictDirectory(dir.path, !dir.has_lock_file)) {
+      total_size -= dir.size;
+      evicted_directories_count_.fetch_add(1, std::memory_order_relaxed);
+      evicted_bytes_.fetch_add(dir.size, std::memory_order_relaxed);
+    }
+  }
+  estimated_size_ = total_size;
 }
 
 }  // namespace oko
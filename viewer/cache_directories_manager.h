@@ -4,35 +4,111 @@
 
 #pragma once
 #include <boost/outcome/result.hpp>
+#include <atomic>
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "viewer/progress.h"
 
 namespace oko {
 
 namespace outcome = BOOST_OUTCOME_V2_NAMESPACE;
 
 // Creates unique cache directories based on provided argument.
+// Directories, that were not used recently, are removed in background
+// when total size of cache exceeds limit. Directories, returned to any
+// running process, are not removed until it exits.
 class CacheDirectoriesManager {
  public:
-  CacheDirectoriesManager() noexcept;
+  static constexpr uint64_t kDefaultMaxSize = 10ull * 1024 * 1024 * 1024;
+
+  // Writes contents of created file to |tmp_file_path|. The file is
+  // removed, if error is returned.
+  using CreateFileCallback = std::function<std::error_code(
+      const std::filesystem::path& tmp_file_path)>;
+
+  struct Stats {
+    // Lookups of files by |GetOrCreateFile|.
+    uint64_t hits_count;
+    uint64_t misses_count;
+    uint64_t evicted_directories_count;
+    uint64_t evicted_bytes;
+    // Size, found by the last eviction, plus size of files added since.
+    uint64_t estimated_size;
+    uint64_t max_size;
+  };
+
+  explicit CacheDirectoriesManager(
+      uint64_t max_size = kDefaultMaxSize) noexcept;
+  // Waits until running eviction stops.
+  ~CacheDirectoriesManager();
+
   outcome::std_result<std::filesystem::path> DirectoryForS3Url(
       const std::string& s3_directory_url) noexcept;
 
+  // Directory is chosen by device, inode, size and modification time of
+  // the file, so cache hit does not read the file. Contents of the file
+  // are hashed only if its metadata is unknown. Hashed bytes are reported
+  // to |progress|, if it is not nullptr. Hashing stops if |progress| is
+  // cancelled.
   outcome::std_result<std::filesystem::path> DirectoryForFile(
-      const std::filesystem::path& file_path) noexcept;
+      const std::filesystem::path& file_path,
+      Progress* progress) noexcept;
 
   outcome::std_result<std::filesystem::path> DirectoryForData(
       std::string_view data) noexcept;
 
+  // Returns true if |path| points inside one of cache directories.
+  bool ContainsPath(const std::filesystem::path& path) const noexcept;
+
   bool is_initialized() const noexcept {
     return !cache_root_path_.empty();
   }
 
+  // Makes file |file_path| in one of cache directories, if it does not
+  // exist, by calling |create_file|. File appears only when it is
+  // complete. Only one process creates file at once; others wait for
+  // it and reuse the result, unless |progress| is cancelled. File, left
+  // incomplete by crashed process, is created again. Returns true if
+  // file was created by this call.
+  outcome::std_result<bool> GetOrCreateFile(
+      const std::filesystem::path& file_path,
+      const Progress* progress,
+      const CreateFileCallback& create_file) noexcept;
+
+  Stats GetStats() const noexcept;
+
  private:
+  void ReportHit() noexcept;
+  // Starts eviction if cache becomes too large.
+  void ReportMiss(uint64_t added_size) noexcept;
   outcome::std_result<std::filesystem::path> DirectoryForHash(
       std::string hash) noexcept;
+  void StartEviction() noexcept;
+  // Removes least recently used directories, until cache fits into
+  // |max_size_|. Runs on thread pool.
+  void EvictDirectories() noexcept;
 
   std::filesystem::path cache_root_path_;
+  const uint64_t max_size_;
+  std::mutex mutex_;
+  // Descriptors of lock files of directories, returned by this instance.
+  // Locks protect directories from eviction by all processes.
+  std::unordered_map<std::string, int> locked_directories_;
+  std::mutex eviction_mutex_;
+  std::future<void> eviction_;
+  std::atomic<bool> cancel_eviction_ = false;
+  std::atomic<uint64_t> hits_count_ = 0;
+  std::atomic<uint64_t> misses_count_ = 0;
+  std::atomic<uint64_t> evicted_directories_count_ = 0;
+  std::atomic<uint64_t> evicted_bytes_ = 0;
+  std::atomic<uint64_t> estimated_size_ = 0;
 };
 
 }  // namespace oko
@@ -36,10 +36,19 @@ outcome::std_result<std::vector<LogFileInfo>>
   return result;
 }
 
-outcome::std_result<std::unique_ptr<LogFile>>
+outcome::std_result<std::filesystem::path>
     DirectoryLogFilesProvider::FetchLog(
-        const std::string& log_file_name) noexcept {
-  return CreateFileForPath(directory_path_ / log_file_name);
+        const std::string& log_file_name,
+        Progress* progress) noexcept {
+  std::filesystem::path result = directory_path_ / log_file_name;
+  ProgressStage fetching(progress, Progress::Stage::kFetching);
+  std::error_code ec;
+  // File is already local, so it is fetched at once.
+  const uint64_t file_size = std::filesystem::file_size(result, ec);
+  if (!ec) {
+    fetching.AddDoneBytes(file_size);
+  }
+  return result;
 }
 
 }  // namespace oko
@@ -20,8 +20,9 @@ class DirectoryLogFilesProvider : public LogFilesProvider {
   outcome::std_result<std::vector<LogFileInfo>>
       GetLogFileInfos() noexcept override;
 
-  outcome::std_result<std::unique_ptr<LogFile>> FetchLog(
-      const std::string& log_file_name) noexcept override;
+  outcome::std_result<std::filesystem::path> FetchLog(
+      const std::string& log_file_name,
+      Progress* progress) noexcept override;
 
  private:
   const std::filesystem::path directory_path_;
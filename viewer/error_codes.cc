@@ -25,6 +25,14 @@ std::string CustomErrorCategory::message(int c) const {
       return "Failed download file";
     case ErrorCodes::kDecompressError:
       return "Failed decompress file";
+    case ErrorCodes::kFailedWriteFile:
+      return "Failed write file";
+    case ErrorCodes::kFileTruncated:
+      return "File was truncated";
+    case ErrorCodes::kFileReplaced:
+      return "File was replaced";
+    case ErrorCodes::kCancelled:
+      return "Operation cancelled";
   }
 }
 
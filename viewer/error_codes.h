@@ -15,6 +15,10 @@ enum class ErrorCodes {
   kFileFormatCorrupted,
   kFailedDownloadFile,
   kDecompressError,
+  kFailedWriteFile,
+  kFileTruncated,
+  kFileReplaced,
+  kCancelled,
 };
 
 // Define a custom error code category derived from std::error_category
@@ -8,6 +8,8 @@
 #include <system_error>
 #include <filesystem>
 
+#include "viewer/progress.h"
+
 namespace oko {
 
 namespace outcome = BOOST_OUTCOME_V2_NAMESPACE;
@@ -20,9 +22,13 @@ class FileDecompressor {
   // decompressor.
   virtual std::optional<std::string> FileNameAfterDecompression(
       const std::string& file_name) const noexcept = 0;
+  // Decompressed bytes of |src_file_path| are reported to |progress|, if
+  // it is not nullptr. Returns |ErrorCodes::kCancelled| if |progress| is
+  // cancelled. |dst_file_path| may be left partially written on errors.
   virtual std::error_code Decompress(
       const std::filesystem::path& src_file_path,
-      const std::filesystem::path& dst_file_path) noexcept = 0;
+      const std::filesystem::path& dst_file_path,
+      Progress* progress) noexcept = 0;
 };
 
 }  // namespace oko
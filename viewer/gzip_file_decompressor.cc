@@ -6,14 +6,22 @@
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
-#include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filter/gzip.hpp>
 #include <fstream>
+#include <vector>
+
+#include "viewer/error_codes.h"
 
 namespace oko {
 
 namespace outcome = BOOST_OUTCOME_V2_NAMESPACE;
 
+namespace {
+
+const size_t kBufferSize = 64 * 1024;
+
+}  // namespace
+
 std::optional<std::string> GzipFileDecompressor::FileNameAfterDecompression(
     const std::string& file_name) const noexcept {
   const std::string_view kExtToStrip{".gz"};
@@ -26,7 +34,8 @@ std::optional<std::string> GzipFileDecompressor::FileNameAfterDecompression(
 
 std::error_code GzipFileDecompressor::Decompress(
     const std::filesystem::path& src_file_path,
-    const std::filesystem::path& dst_file_path) noexcept {
+    const std::filesystem::path& dst_file_path,
+    Progress* progress) noexcept {
   std::ifstream src_file(src_file_path, std::ios::in | std::ios::binary);
   if (!src_file.is_open()) {
     return std::error_code(errno, std::generic_category());
@@ -38,11 +47,42 @@ std::error_code GzipFileDecompressor::Decompress(
     return std::error_code(errno, std::generic_category());
   }
 
+  std::error_code ec;
+  const uint64_t src_file_size = std::filesystem::file_size(
+      src_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  ProgressStage decompressing(progress, Progress::Stage::kDecompressing);
+  decompressing.AddTotalBytes(src_file_size);
+
   boost::iostreams::filtering_streambuf<boost::iostreams::input> out;
   out.push(boost::iostreams::gzip_decompressor());
   out.push(src_file);
-  boost::iostreams::copy(out, dst_file);
-
+  // Stream reports decompression errors with bad bit, instead of
+  // exceptions.
+  std::istream decompressed(&out);
+  std::vector<char> buf(kBufferSize);
+  uint64_t reported_size = 0;
+  while (decompressed) {
+    if (decompressing.is_cancelled()) {
+      return ErrorCodes::kCancelled;
+    }
+    decompressed.read(buf.data(), buf.size());
+    dst_file.write(buf.data(), decompressed.gcount());
+    // Compressed data is read ahead, so position is not exact.
+    const std::streamoff src_pos = src_file.tellg();
+    if (src_pos > 0 && static_cast<uint64_t>(src_pos) > reported_size) {
+      decompressing.AddDoneBytes(src_pos - reported_size);
+      reported_size = src_pos;
+    }
+  }
+  if (decompressed.bad()) {
+    return ErrorCodes::kDecompressError;
+  }
+  if (src_file_size > reported_size) {
+    decompressing.AddDoneBytes(src_file_size - reported_size);
+  }
   return std::error_code();
 }
 
@@ -16,7 +16,8 @@ class GzipFileDecompressor : public FileDecompressor {
 
   std::error_code Decompress(
       const std::filesystem::path& src_file_path,
-      const std::filesystem::path& dst_file_path) noexcept override;
+      const std::filesystem::path& dst_file_path,
+      Progress* progress) noexcept override;
 };
 
 }  // namespace oko
@@ -3,10 +3,12 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <cstdint>
 #include <filesystem>
 #include <system_error>
 #include <vector>
 #include "viewer/log_view.h"
+#include "viewer/progress.h"
 
 namespace oko {
 
@@ -17,8 +19,47 @@ class LogFile : public LogView {
   // Parses file, provided in constructor of concrete class.
   // May create inside memory view of the file, so it is expected
   // that file will not be changed or deleted during lifetime of this object.
-  virtual std::error_code Parse() noexcept = 0;
+  // Parsed records are published, and become visible through |GetRecords|
+  // only after |UpdateRecords| call. Before publishing all records
+  // parser may publish some of them, e.g. records from the beginning
+  // of the file, so they may be shown to user while parsing continues.
+  // Parsed bytes and records are reported to |progress|, if it is not
+  // nullptr. If |progress| is cancelled, returns |ErrorCodes::kCancelled|
+  // and file should be discarded.
+  virtual std::error_code Parse(Progress* progress) noexcept = 0;
+  // Makes last published records visible through |GetRecords|.
+  // Returns true if visible records changed. May be called concurrently
+  // with |Parse|, on the thread that uses |GetRecords| results.
+  virtual bool UpdateRecords() noexcept = 0;
+  // Returns true if |UpdateRecords| will change visible records. Allows
+  // to stop using old records before they are replaced.
+  virtual bool has_published_records() const noexcept = 0;
+  // Number of first visible records, that were not changed by the last
+  // |UpdateRecords| call. Records after them were replaced or appended.
+  virtual size_t kept_records_count() const noexcept = 0;
+  // Makes file followed - records, appended to it after |Parse|, are
+  // published by |ParseAppended|. Must be called before |Parse|.
+  // Returns false if file can not be followed, e.g. its format needs
+  // all records to convert timestamps. Followed file must only grow.
+  virtual bool EnableFollowing() noexcept = 0;
+  virtual bool is_followed() const noexcept = 0;
+  // Parses and publishes records, appended to followed file since the
+  // last parse. Does nothing until |Parse| finishes. Must not be called
+  // concurrently with itself. Fails if file was truncated or replaced,
+  // then it can not be followed any more.
+  virtual std::error_code ParseAppended() noexcept = 0;
+  // Returns true if |GetRecords| returns all records of the file.
+  virtual bool has_all_records() const noexcept = 0;
+  // Number of records parsed so far. May be called from any thread.
+  virtual size_t parsed_records_count() const noexcept = 0;
   virtual const std::filesystem::path& file_path() const noexcept = 0;
+  // Path of file, where parsed records are persisted. Empty if records
+  // are not persisted. Other indexes of the file may be stored near it.
+  virtual const std::filesystem::path& index_file_path() const noexcept = 0;
+  // Identity of index file, that records were read from or written to,
+  // see |LogIndexFile|. Zero if there is no such file. Valid after all
+  // records are published.
+  virtual uint64_t index_id() const noexcept = 0;
 };
 
 }  // namespace oko
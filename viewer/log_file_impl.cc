@@ -4,42 +4,503 @@
 
 #include "viewer/log_file_impl.h"
 #include "viewer/error_codes.h"
+#include "viewer/log_index_file.h"
+#include "viewer/parallel_for.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
 #include <utility>
 
 namespace oko {
 
+namespace {
+
+// Files smaller then that are not worth splitting.
+const size_t kMinChunkSize = 4 * 1024 * 1024;
+// Size of the first chunk, records of which are published before
+// parsing of the whole file is finished.
+const size_t kFirstChunkSize = 1024 * 1024;
+// Splitting file on more chunks then threads, helps to keep all threads
+// busy when parsing time of chunks differ.
+const size_t kChunksPerThread = 4;
+// Address space, reserved after the end of followed file for appended
+// data. Data, appended after that, is not parsed.
+const size_t kFollowReservedSize = size_t(16) * 1024 * 1024 * 1024;
+
+bool TimestampLess(const LogRecord& first, const LogRecord& second) noexcept {
+  return first.timestamp() < second.timestamp();
+}
+
+}  // namespace
+
 LogFileImpl::LogFileImpl(std::filesystem::path file_path) noexcept
     : file_path_(std::move(file_path)) {
 }
 
-std::error_code LogFileImpl::Parse() noexcept {
-  records_.clear();
+LogFileImpl::~LogFileImpl() {
+  if (follow_data_) {
+    munmap(const_cast<char*>(follow_data_), follow_mapping_size_);
+  }
+  if (follow_fd_ >= 0) {
+    close(follow_fd_);
+  }
+}
+
+std::error_code LogFileImpl::Parse(Progress* progress) noexcept {
+  parsed_records_count_ = 0;
   std::error_code ec;
-  auto file_size = std::filesystem::file_size(file_path_, ec);
+  std::string_view file_data;
+  if (is_followed_) {
+    ec = MapFollowedFile(&file_data);
+    if (ec) {
+      return ec;
+    }
+  } else {
+    auto file_size = std::filesystem::file_size(file_path_, ec);
+    if (ec) {
+      return ec;
+    }
+    // mapped_file constructor will throw on empty files.
+    if (file_size == 0) {
+      PublishRecords(RecordStore(), true);
+      return ErrorCodes::kOk;
+    }
+    mapped_file_ = boost::iostreams::mapped_file(
+        file_path_, boost::iostreams::mapped_file::readonly);
+    if (!mapped_file_.is_open()) {
+      return ErrorCodes::kFailedMapFile;
+    }
+    file_data = std::string_view(mapped_file_.data(), mapped_file_.size());
+  }
+  ProgressStage parsing(progress, Progress::Stage::kParsing);
+  parsing.AddTotalBytes(file_data.size());
+  if (!index_file_path_.empty()) {
+    RecordStore indexed_records(file_data);
+    if (!LogIndexFile::Read(
+            index_file_path_,
+            file_path_,
+            file_data,
+            &indexed_records,
+            &index_id_)) {
+      parsing.AddDoneBytes(file_data.size());
+      parsing.AddDoneRecords(indexed_records.size());
+      parsed_records_count_ = indexed_records.size();
+      PublishRecords(std::move(indexed_records), true);
+      return ErrorCodes::kOk;
+    }
+  }
+  std::vector<LogRecord> records = ParseChunks(
+      file_data, SplitOnChunks(file_data), &parsing);
+  if (parsing.is_cancelled()) {
+    // Records may be incomplete or not sorted.
+    return ErrorCodes::kCancelled;
+  }
+  ec = ConvertTimestamps(file_data, &records);
   if (ec) {
     return ec;
   }
-  // mapped_file constructor will throw on empty files.
-  if (file_size == 0) {
+  RecordStore result(file_data);
+  result.reserve(records.size());
+  for (const LogRecord& rec : records) {
+    result.Append(rec);
+  }
+  if (is_followed_) {
+    parsed_size_ = file_data.size();
+    SetTailRecord(file_data, 0, records);
+  }
+  records = std::vector<LogRecord>();
+  if (!index_file_path_.empty()) {
+    // Failure to write index is not fatal - file will be just parsed
+    // again next time.
+    LogIndexFile::Write(
+        index_file_path_, file_path_, file_data, result, &index_id_);
+  }
+  // File may be destroyed as soon as all records are published, so
+  // nothing is touched after it. Records, appended before that, are
+  // merged after published ones by |UpdateRecords|.
+  follow_ready_ = is_followed_;
+  PublishRecords(std::move(result), true);
+  return ErrorCodes::kOk;
+}
+
+bool LogFileImpl::EnableFollowing() noexcept {
+  // Files with index are copies in cache, they never change.
+  if (!index_file_path_.empty() || !CanFollow()) {
+    return false;
+  }
+  is_followed_ = true;
+  return true;
+}
+
+std::error_code LogFileImpl::ParseAppended() noexcept {
+  if (!follow_ready_) {
+    return ErrorCodes::kOk;
+  }
+  struct stat file_stat;
+  if (fstat(follow_fd_, &file_stat) != 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  const size_t file_size = static_cast<size_t>(file_stat.st_size);
+  if (file_size < parsed_size_) {
+    // Parsed records point to data, that does not exist any more.
+    return ErrorCodes::kFileTruncated;
+  }
+  std::string_view file_data(
+      follow_data_, std::min(file_size, follow_mapping_size_));
+  const size_t last_line_end = file_data.rfind('\n');
+  if (last_line_end == std::string_view::npos ||
+      last_line_end < parsed_size_) {
+    // Replaced file, e.g. rotated one, may still get records from its
+    // writer, so this is checked only when it stops growing.
+    struct stat path_stat;
+    if (stat(file_path_.c_str(), &path_stat) != 0 ||
+        path_stat.st_dev != file_stat.st_dev ||
+        path_stat.st_ino != file_stat.st_ino) {
+      return ErrorCodes::kFileReplaced;
+    }
+    return ErrorCodes::kOk;
+  }
+  file_data = file_data.substr(0, last_line_end + 1);
+  std::vector<LogRecord> records;
+  ParseChunk(file_data.substr(tail_record_offset_), &records);
+  std::sort(records.begin(), records.end(), &TimestampLess);
+  const std::error_code ec = ConvertTimestamps(file_data, &records);
+  if (ec) {
+    return ec;
+  }
+  const size_t parse_begin = tail_record_offset_;
+  parsed_size_ = file_data.size();
+  if (records.empty()) {
+    tail_record_offset_ = parsed_size_;
     return ErrorCodes::kOk;
   }
-  mapped_file_ = boost::iostreams::mapped_file(
-      file_path_, boost::iostreams::mapped_file::readonly);
-  if (!mapped_file_.is_open()) {
+  // First parsed record is new version of the old tail record.
+  std::optional<LogRecord> replaced = std::move(tail_record_);
+  parsed_records_count_ += records.size() - (replaced ? 1 : 0);
+  SetTailRecord(file_data, parse_begin, records);
+  PublishAppendedRecords(std::move(records), std::move(replaced));
+  return ErrorCodes::kOk;
+}
+
+std::error_code LogFileImpl::MapFollowedFile(
+    std::string_view* file_data) noexcept {
+  follow_fd_ = open(file_path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (follow_fd_ < 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  struct stat file_stat;
+  if (fstat(follow_fd_, &file_stat) != 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  const size_t file_size = static_cast<size_t>(file_stat.st_size);
+  // Pages after end of file become accessible when file grows.
+  follow_mapping_size_ = file_size + kFollowReservedSize;
+  void* data = mmap(
+      nullptr, follow_mapping_size_, PROT_READ, MAP_SHARED, follow_fd_, 0);
+  if (data == MAP_FAILED) {
+    follow_mapping_size_ = 0;
     return ErrorCodes::kFailedMapFile;
   }
-  return ParseImpl(
-      std::string_view(mapped_file_.data(), mapped_file_.size()),
-      &records_);
+  follow_data_ = static_cast<const char*>(data);
+  // Last line may be not written completely yet.
+  const size_t last_line_end = std::string_view(
+      follow_data_, file_size).rfind('\n');
+  *file_data = std::string_view(
+      follow_data_,
+      last_line_end == std::string_view::npos ? 0 : last_line_end + 1);
+  return ErrorCodes::kOk;
+}
+
+size_t LogFileImpl::FindLastRecordStart(
+    std::string_view file_data, size_t begin) const noexcept {
+  // Points after the line feed of current line.
+  size_t line_end = file_data.size();
+  while (line_end > begin) {
+    const size_t prev_line_end = (line_end < 2) ?
+        std::string_view::npos : file_data.rfind('\n', line_end - 2);
+    const size_t line_start = (prev_line_end == std::string_view::npos) ?
+        0 : prev_line_end + 1;
+    if (line_start < begin) {
+      break;
+    }
+    // Search only inside the line, to check whether record starts there.
+    if (FindRecordStart(file_data.substr(0, line_end), line_start) ==
+            line_start) {
+      return line_start;
+    }
+    line_end = line_start;
+  }
+  return file_data.size();
+}
+
+void LogFileImpl::SetTailRecord(
+    std::string_view file_data,
+    size_t begin,
+    const std::vector<LogRecord>& records) noexcept {
+  tail_record_offset_ = FindLastRecordStart(file_data, begin);
+  tail_record_ = std::nullopt;
+  if (tail_record_offset_ == file_data.size()) {
+    return;
+  }
+  // Messages of records are in file order.
+  const auto it = std::max_element(
+      records.begin(),
+      records.end(),
+      [](const LogRecord& first, const LogRecord& second) {
+        return first.message().data() < second.message().data();
+      });
+  if (it != records.end()) {
+    tail_record_ = *it;
+  }
+}
+
+bool LogFileImpl::UpdateRecords() noexcept {
+  std::lock_guard<std::mutex> lock(published_records_mutex_);
+  if (!published_records_ && published_appended_records_.empty()) {
+    return false;
+  }
+  kept_records_count_ = records_.size();
+  if (published_records_) {
+    records_ = std::move(*published_records_);
+    published_records_ = std::nullopt;
+    has_all_records_ = published_records_final_;
+    kept_records_count_ = 0;
+  }
+  if (!published_appended_records_.empty()) {
+    kept_records_count_ = std::min(
+        kept_records_count_, MergeAppendedRecords());
+  }
+  return true;
+}
+
+bool LogFileImpl::has_published_records() const noexcept {
+  std::lock_guard<std::mutex> lock(published_records_mutex_);
+  return published_records_.has_value() ||
+      !published_appended_records_.empty();
+}
+
+void LogFileImpl::PublishAppendedRecords(
+    std::vector<LogRecord> records,
+    std::optional<LogRecord> replaced) noexcept {
+  std::lock_guard<std::mutex> lock(published_records_mutex_);
+  if (published_appended_records_.empty()) {
+    published_appended_records_ = std::move(records);
+    published_replaced_record_ = std::move(replaced);
+    return;
+  }
+  // Replaced record is not visible yet, so it is dropped from previously
+  // published ones. It is usually near their end.
+  if (replaced) {
+    const auto it = std::find_if(
+        published_appended_records_.rbegin(),
+        published_appended_records_.rend(),
+        [&replaced](const LogRecord& rec) {
+          return rec.message().data() == replaced->message().data();
+        });
+    assert(it != published_appended_records_.rend());
+    published_appended_records_.erase(std::next(it).base());
+  }
+  std::vector<LogRecord> merged;
+  merged.reserve(published_appended_records_.size() + records.size());
+  std::merge(
+      published_appended_records_.begin(),
+      published_appended_records_.end(),
+      records.begin(),
+      records.end(),
+      std::back_inserter(merged),
+      &TimestampLess);
+  published_appended_records_ = std::move(merged);
+}
+
+size_t LogFileImpl::MergeAppendedRecords() noexcept {
+  const RecordsAccessor visible(&records_);
+  // Only records after the first appended or replaced one are moved.
+  size_t kept = visible.LowerBound(
+      published_appended_records_.front().timestamp());
+  size_t replaced_index = records_.size();
+  if (published_replaced_record_) {
+    for (size_t i = visible.LowerBound(
+             published_replaced_record_->timestamp());
+         i < records_.size();
+         ++i) {
+      if (records_.message(i).data() ==
+              published_replaced_record_->message().data()) {
+        replaced_index = i;
+        break;
+      }
+    }
+    assert(replaced_index < records_.size());
+    kept = std::min(kept, replaced_index);
+  }
+  std::vector<LogRecord> moved;
+  moved.reserve(records_.size() - kept);
+  for (size_t i = kept; i < records_.size(); ++i) {
+    if (i != replaced_index) {
+      moved.push_back(records_[i]);
+    }
+  }
+  records_.resize(kept);
+  records_.reserve(
+      kept + moved.size() + published_appended_records_.size());
+  auto moved_it = moved.begin();
+  for (const LogRecord& rec : published_appended_records_) {
+    while (moved_it != moved.end() && !TimestampLess(rec, *moved_it)) {
+      records_.Append(*moved_it++);
+    }
+    records_.Append(rec);
+  }
+  for (; moved_it != moved.end(); ++moved_it) {
+    records_.Append(*moved_it);
+  }
+  published_appended_records_.clear();
+  published_replaced_record_ = std::nullopt;
+  return kept;
+}
+
+void LogFileImpl::PublishRecords(
+    RecordStore records, bool is_final) noexcept {
+  std::lock_guard<std::mutex> lock(published_records_mutex_);
+  if (published_records_final_) {
+    // Never replace all records with partial ones.
+    return;
+  }
+  published_records_ = std::move(records);
+  published_records_final_ = is_final;
+}
+
+void LogFileImpl::PublishFirstChunkRecords(
+    std::string_view file_data,
+    std::vector<LogRecord> records) noexcept {
+  // Conversion may fail, e.g. if chunk does not have enough data for it.
+  // Just wait for all records in that case.
+  if (ConvertTimestamps(file_data, &records)) {
+    return;
+  }
+  RecordStore result(file_data);
+  result.reserve(records.size());
+  for (const LogRecord& rec : records) {
+    result.Append(rec);
+  }
+  PublishRecords(std::move(result), false);
+}
+
+std::vector<std::string_view> LogFileImpl::SplitOnChunks(
+    std::string_view file_data) const noexcept {
+  const size_t chunks_count = std::clamp<size_t>(
+      file_data.size() / kMinChunkSize,
+      1,
+      GetParallelism() * kChunksPerThread);
+  std::vector<std::string_view> result;
+  result.reserve(chunks_count);
+  size_t chunk_start = FindRecordStart(file_data, 0);
+  for (size_t i = 1; i <= chunks_count; ++i) {
+    if (chunk_start >= file_data.size()) {
+      break;
+    }
+    size_t chunk_end = file_data.size();
+    if (i < chunks_count) {
+      const size_t desired_chunk_end = (i == 1) ?
+          kFirstChunkSize : file_data.size() / chunks_count * i;
+      chunk_end = FindRecordStart(
+          file_data,
+          std::max(chunk_start + 1, desired_chunk_end));
+    }
+    result.emplace_back(file_data.substr(
+        chunk_start, chunk_end - chunk_start));
+    chunk_start = chunk_end;
+  }
+  return result;
+}
+
+std::vector<LogRecord> LogFileImpl::ParseChunks(
+    std::string_view file_data,
+    const std::vector<std::string_view>& chunks,
+    ProgressStage* parsing) noexcept {
+  std::vector<std::vector<LogRecord>> chunk_records(chunks.size());
+  std::atomic<size_t> next_chunk = 0;
+  ParallelFor(
+      std::min(chunks.size(), GetParallelism()),
+      [&chunks, &chunk_records, &next_chunk, file_data, parsing, this](
+          size_t) {
+        for (size_t i = next_chunk++;
+             i < chunks.size() && !parsing->is_cancelled();
+             i = next_chunk++) {
+          ParseChunk(chunks[i], &chunk_records[i]);
+          // Some lines may be misordered, so we must sort.
+          std::sort(
+              chunk_records[i].begin(),
+              chunk_records[i].end(),
+              &TimestampLess);
+          parsed_records_count_ += chunk_records[i].size();
+          parsing->AddDoneBytes(chunks[i].size());
+          parsing->AddDoneRecords(chunk_records[i].size());
+          if (i == 0 && chunks.size() > 1) {
+            PublishFirstChunkRecords(file_data, chunk_records[i]);
+          }
+        }
+      });
+  size_t total_size = 0;
+  for (const auto& records : chunk_records) {
+    total_size += records.size();
+  }
+  std::vector<LogRecord> result;
+  // Boundaries of sorted runs inside |result|.
+  std::vector<size_t> run_starts;
+  run_starts.reserve(chunk_records.size() + 1);
+  result.reserve(total_size);
+  for (auto& records : chunk_records) {
+    run_starts.push_back(result.size());
+    result.insert(result.end(), records.begin(), records.end());
+    records = std::vector<LogRecord>();
+  }
+  run_starts.push_back(result.size());
+  ProgressStage merging(parsing->progress(), Progress::Stage::kMerging);
+  // Each level of merging passes all records.
+  size_t merge_levels_count = 0;
+  for (size_t runs_count = chunk_records.size(); runs_count > 1;
+       runs_count = (runs_count + 1) / 2) {
+    ++merge_levels_count;
+  }
+  merging.AddTotalRecords(result.size() * merge_levels_count);
+  // Merge adjacent sorted runs pairwise until single run remains.
+  while (run_starts.size() > 2 && !merging.is_cancelled()) {
+    const size_t pairs_count = (run_starts.size() - 1) / 2;
+    ParallelFor(pairs_count, [&run_starts, &result, &merging](size_t i) {
+      std::inplace_merge(
+          result.begin() + run_starts[2 * i],
+          result.begin() + run_starts[2 * i + 1],
+          result.begin() + run_starts[2 * i + 2],
+          &TimestampLess);
+      merging.AddDoneRecords(run_starts[2 * i + 2] - run_starts[2 * i]);
+    });
+    if ((run_starts.size() - 1) % 2 != 0) {
+      // Last run is left as is.
+      merging.AddDoneRecords(
+          run_starts.back() - run_starts[run_starts.size() - 2]);
+    }
+    std::vector<size_t> merged_run_starts;
+    merged_run_starts.reserve(pairs_count + 2);
+    for (size_t i = 0; i + 1 < run_starts.size(); i += 2) {
+      merged_run_starts.push_back(run_starts[i]);
+    }
+    merged_run_starts.push_back(run_starts.back());
+    run_starts = std::move(merged_run_starts);
+  }
+  return result;
 }
 
 const std::filesystem::path& LogFileImpl::file_path() const noexcept {
   return file_path_;
 }
 
-const std::vector<LogRecord>& LogFileImpl::GetRecords() const noexcept {
-  return records_;
+RecordsAccessor LogFileImpl::GetRecords() const noexcept {
+  return RecordsAccessor(&records_);
 }
 
 }  // namespace oko
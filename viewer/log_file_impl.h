@@ -3,9 +3,13 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <atomic>
 #include <boost/iostreams/device/mapped_file.hpp>
 #include <filesystem>
+#include <mutex>
+#include <optional>
 #include <string_view>
+#include <utility>
 #include <vector>
 
 #include "viewer/log_file.h"
@@ -14,25 +18,148 @@ namespace oko {
 
 // Implementation of LogFile interface.
 // Maps whole file into memory during parsing.
+// Parsing is performed in three steps:
+// 1. File is split on chunks at record boundaries, and every chunk is
+//    parsed in parallel by |ParseChunk|. Records produced at this step
+//    have "raw" timestamps, meaning of which depends on concrete log format.
+// 2. Records from all chunks are stitched together and ordered by their
+//    raw timestamps.
+// 3. |ConvertTimestamps| turns raw timestamps into real ones. That step
+//    may use data from any part of the file.
+// First chunk is small, and its records are published as soon as
+// it is parsed, to show them to user while other chunks are processed.
+// Followed file is mapped with reserved address space after its end, so
+// appended data is parsed without re-mapping. Only complete lines are
+// parsed, starting from the last record, which may get more continuation
+// lines. Appended records are merged into the tail of visible records.
 class LogFileImpl : public LogFile {
  public:
   explicit LogFileImpl(std::filesystem::path file_path) noexcept;
+  ~LogFileImpl() override;
   // May create inside memory view of the file, so it is expected
   // that file will not be changed or deleted during lifetime of this object.
-  std::error_code Parse() noexcept override;
+  std::error_code Parse(Progress* progress) noexcept override;
   const std::filesystem::path& file_path() const noexcept override;
+  const std::filesystem::path& index_file_path() const noexcept override {
+    return index_file_path_;
+  }
+  uint64_t index_id() const noexcept override {
+    return index_id_;
+  }
 
-  const std::vector<LogRecord>& GetRecords() const noexcept override;
+  bool UpdateRecords() noexcept override;
+  bool has_published_records() const noexcept override;
+  size_t kept_records_count() const noexcept override {
+    return kept_records_count_;
+  }
+  bool EnableFollowing() noexcept override;
+  bool is_followed() const noexcept override {
+    return is_followed_;
+  }
+  std::error_code ParseAppended() noexcept override;
+  bool has_all_records() const noexcept override {
+    return has_all_records_;
+  }
+  size_t parsed_records_count() const noexcept override {
+    return parsed_records_count_;
+  }
+
+  RecordsAccessor GetRecords() const noexcept override;
+
+  // If set, records are loaded from index file instead of parsing,
+  // and index file is (re)created after successful parsing.
+  // Should be used only for files, that never change, e.g. files
+  // in cache directory.
+  void set_index_file_path(std::filesystem::path index_file_path) noexcept {
+    index_file_path_ = std::move(index_file_path);
+  }
 
  protected:
-  virtual std::error_code ParseImpl(
+  // Returns offset of the first record start at or after |pos|, or
+  // |file_data.size()| if there are no more records.
+  virtual size_t FindRecordStart(
+      std::string_view file_data,
+      size_t pos) const noexcept = 0;
+  // Appends records from |chunk_data|, which starts at record boundary,
+  // to |records| with raw timestamps. Called concurrently for different
+  // chunks, so must not modify object state.
+  virtual void ParseChunk(
+      std::string_view chunk_data,
+      std::vector<LogRecord>* records) const noexcept = 0;
+  // Replaces raw timestamps of |records| with real ones. |records| are
+  // ordered by raw timestamps; conversion must preserve that order.
+  virtual std::error_code ConvertTimestamps(
       std::string_view file_data,
       std::vector<LogRecord>* records) noexcept = 0;
+  // Returns true if records, appended to the file, may be parsed
+  // separately, see |EnableFollowing|.
+  virtual bool CanFollow() const noexcept {
+    return false;
+  }
 
  private:
-  std::vector<LogRecord> records_;
+  std::vector<std::string_view> SplitOnChunks(
+      std::string_view file_data) const noexcept;
+  // Parsed chunks are reported to |parsing|. Returns incomplete result
+  // if |parsing| is cancelled.
+  std::vector<LogRecord> ParseChunks(
+      std::string_view file_data,
+      const std::vector<std::string_view>& chunks,
+      ProgressStage* parsing) noexcept;
+  void PublishFirstChunkRecords(
+      std::string_view file_data,
+      std::vector<LogRecord> records) noexcept;
+  void PublishRecords(RecordStore records, bool is_final) noexcept;
+  std::error_code MapFollowedFile(std::string_view* file_data) noexcept;
+  // Returns offset of the last record start in range [begin, end of
+  // |file_data|), or |file_data.size()| if there is no record there.
+  size_t FindLastRecordStart(
+      std::string_view file_data, size_t begin) const noexcept;
+  // Remembers last record in file, which will be parsed again with
+  // appended data. |records| are in range [begin, end of |file_data|).
+  void SetTailRecord(
+      std::string_view file_data,
+      size_t begin,
+      const std::vector<LogRecord>& records) noexcept;
+  // |records| must be sorted and contain new version of |replaced|
+  // record, if it is set.
+  void PublishAppendedRecords(
+      std::vector<LogRecord> records,
+      std::optional<LogRecord> replaced) noexcept;
+  // Merges appended records into visible ones. Returns number of first
+  // visible records, that were not changed.
+  size_t MergeAppendedRecords() noexcept;
+
+  // Records, visible to the user of this class. Accessed only on
+  // thread that calls |UpdateRecords|.
+  RecordStore records_;
+  bool has_all_records_ = false;
+  size_t kept_records_count_ = 0;
+  // Records, published by parsing thread, but not yet visible.
+  mutable std::mutex published_records_mutex_;
+  std::optional<RecordStore> published_records_;
+  bool published_records_final_ = false;
+  // Sorted records, appended to followed file, but not yet visible.
+  std::vector<LogRecord> published_appended_records_;
+  // Visible record, replaced by one of appended records.
+  std::optional<LogRecord> published_replaced_record_;
+  bool is_followed_ = false;
+  // Set when |Parse| finishes, so appended records may be parsed.
+  std::atomic<bool> follow_ready_ = false;
+  int follow_fd_ = -1;
+  const char* follow_data_ = nullptr;
+  size_t follow_mapping_size_ = 0;
+  // End of the last complete line, that was parsed.
+  size_t parsed_size_ = 0;
+  // Start of the last record in file, or |parsed_size_| if there is no
+  // records yet. Parsing of appended data starts there.
+  size_t tail_record_offset_ = 0;
+  std::optional<LogRecord> tail_record_;
+  std::atomic<size_t> parsed_records_count_ = 0;
   boost::iostreams::mapped_file_source mapped_file_;
   const std::filesystem::path file_path_;
+  std::filesystem::path index_file_path_;
+  uint64_t index_id_ = 0;
 };
 
 }  // namespace oko
@@ -0,0 +1,126 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/log_files_follower.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace oko {
+
+namespace {
+
+// Files are checked even without notifications, since data may be
+// appended before file is watched or parsed.
+const int kCheckIntervalMs = 1000;
+// Appended data is collected during that time and parsed at once, so
+// fast writers do not cause parsing of every line separately.
+const int kMinParseIntervalMs = 100;
+
+}  // namespace
+
+LogFilesFollower::LogFilesFollower() noexcept {
+  inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (is_initialized()) {
+    thread_ = std::thread([this] { Run(); });
+  }
+}
+
+LogFilesFollower::~LogFilesFollower() {
+  if (thread_.joinable()) {
+    const uint64_t value = 1;
+    [[maybe_unused]] ssize_t written = write(
+        wake_fd_, &value, sizeof(value));
+    thread_.join();
+  }
+  if (inotify_fd_ >= 0) {
+    close(inotify_fd_);
+  }
+  if (wake_fd_ >= 0) {
+    close(wake_fd_);
+  }
+}
+
+std::error_code LogFilesFollower::Watch(LogFile* file) noexcept {
+  const int wd = inotify_add_watch(
+      inotify_fd_, file->file_path().c_str(), IN_MODIFY);
+  if (wd < 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  files_.emplace_back(wd, file);
+  return std::error_code();
+}
+
+void LogFilesFollower::Unwatch(LogFile* file) noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto it = std::find_if(
+      files_.begin(),
+      files_.end(),
+      [file](const std::pair<int, LogFile*>& p) {
+        return p.second == file;
+      });
+  if (it == files_.end()) {
+    return;
+  }
+  inotify_rm_watch(inotify_fd_, it->first);
+  files_.erase(it);
+}
+
+std::vector<std::pair<std::filesystem::path, std::error_code>>
+    LogFilesFollower::RetrieveStoppedFiles() noexcept {
+  std::lock_guard<std::mutex> lock(stopped_files_mutex_);
+  return std::move(stopped_files_);
+}
+
+void LogFilesFollower::Run() noexcept {
+  pollfd fds[2] = {
+    {inotify_fd_, POLLIN, 0},
+    {wake_fd_, POLLIN, 0},
+  };
+  while (true) {
+    if (poll(fds, 2, kCheckIntervalMs) < 0 && errno != EINTR) {
+      return;
+    }
+    if (fds[1].revents & POLLIN) {
+      return;
+    }
+    if (fds[0].revents & POLLIN) {
+      // All files are checked, so events themselves are not needed.
+      char buffer[4096];
+      while (read(inotify_fd_, buffer, sizeof(buffer)) > 0) {
+      }
+    }
+    ParseAppended();
+    if (poll(&fds[1], 1, kMinParseIntervalMs) > 0) {
+      return;
+    }
+  }
+}
+
+void LogFilesFollower::ParseAppended() noexcept {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (auto it = files_.begin(); it != files_.end();) {
+    if (std::error_code ec = it->second->ParseAppended(); ec) {
+      // E.g. file was truncated, its new records can not be shown.
+      {
+        std::lock_guard<std::mutex> stopped_lock(stopped_files_mutex_);
+        stopped_files_.emplace_back(it->second->file_path(), ec);
+      }
+      inotify_rm_watch(inotify_fd_, it->first);
+      it = files_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+}  // namespace oko
@@ -0,0 +1,55 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "viewer/log_file.h"
+
+namespace oko {
+
+// Watches followed log files (see |LogFile::EnableFollowing|) with inotify
+// and parses records, appended to them, on background thread.
+class LogFilesFollower {
+ public:
+  LogFilesFollower() noexcept;
+  ~LogFilesFollower();
+
+  bool is_initialized() const noexcept {
+    return inotify_fd_ >= 0 && wake_fd_ >= 0;
+  }
+
+  // Starts following |file|, which may be still parsed.
+  std::error_code Watch(LogFile* file) noexcept;
+  // Stops following |file|. It is not used after return, so may be
+  // destroyed.
+  void Unwatch(LogFile* file) noexcept;
+  // Returns paths of files, that are not followed any more since the
+  // previous call, e.g. because they were truncated, with errors.
+  std::vector<std::pair<std::filesystem::path, std::error_code>>
+      RetrieveStoppedFiles() noexcept;
+
+ private:
+  void Run() noexcept;
+  void ParseAppended() noexcept;
+
+  int inotify_fd_ = -1;
+  // Signalled to stop |thread_|.
+  int wake_fd_ = -1;
+  std::mutex mutex_;
+  // Watch descriptors of followed files.
+  std::vector<std::pair<int, LogFile*>> files_;
+  // Separate mutex, so UI does not wait while appended records are parsed.
+  std::mutex stopped_files_mutex_;
+  std::vector<std::pair<std::filesystem::path, std::error_code>>
+      stopped_files_;
+  std::thread thread_;
+};
+
+}  // namespace oko
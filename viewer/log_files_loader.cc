@@ -0,0 +1,282 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/log_files_loader.h"
+
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "viewer/error_codes.h"
+#include "viewer/thread_pool.h"
+
+namespace oko {
+
+namespace {
+
+enum Stage {
+  kFetching = 0,
+  kDecompressing,
+  kParsing,
+  kStagesCount,
+};
+
+// Fetching mostly waits for network, so more files are fetched at once
+// then there are CPU cores.
+constexpr size_t kFetchingFilesCount = 8;
+// Each file is parsed by several threads itself.
+constexpr size_t kParsingFilesCount = 2;
+constexpr size_t kQueuedFilesCount = 16;
+
+}  // namespace
+
+struct LogFilesLoader::State : public std::enable_shared_from_this<State> {
+  struct FileState {
+    std::string name;
+    std::filesystem::path fetched_path;
+    std::unique_ptr<LogFile> file;
+    // Stays valid after |file| is retrieved, until parsing finishes.
+    LogFile* parsed_file = nullptr;
+    std::error_code open_error;
+  };
+
+  // Starts files, that wait for stages, while limits allow it.
+  // |mutex| must be locked.
+  void ScheduleStages() noexcept;
+  void RunStage(Stage stage, size_t index) noexcept;
+  // Does work of |stage| for |file_state|. Sets |skipped| if file should
+  // not pass further stages.
+  std::error_code ProcessFile(
+      Stage stage, FileState* file_state, bool* skipped) noexcept;
+  size_t StageLimit(Stage stage) const noexcept;
+
+  LogFilesProvider* files_provider;
+  Options options;
+  Progress progress;
+  Limits limits;
+  std::mutex mutex;
+  // Not resized after construction, so each stage task works with own
+  // element without locking.
+  std::vector<FileState> files;
+  // Indexes of files, waiting for each stage.
+  std::deque<size_t> waiting_files[kStagesCount];
+  size_t running_files_count[kStagesCount] = {};
+  // Files, that did not pass decompression stage and did not fail yet.
+  size_t not_opened_files_count = 0;
+  // Files, that did not pass all stages and did not fail yet.
+  size_t not_finished_files_count = 0;
+  std::error_code parse_error;
+  std::promise<std::error_code> parse_result;
+};
+
+void LogFilesLoader::State::ScheduleStages() noexcept {
+  // Later stages go first, to free queues before them.
+  for (int i = kStagesCount - 1; i >= 0; --i) {
+    const Stage stage = static_cast<Stage>(i);
+    while (!waiting_files[stage].empty() &&
+        running_files_count[stage] < StageLimit(stage) &&
+        (stage + 1 == kStagesCount ||
+         waiting_files[stage + 1].size() + running_files_count[stage] <
+            limits.queued_files_count)) {
+      const size_t index = waiting_files[stage].front();
+      waiting_files[stage].pop_front();
+      ++running_files_count[stage];
+      auto task = [self = shared_from_this(), stage, index] {
+        self->RunStage(stage, index);
+      };
+      if (stage == kFetching) {
+        // Blocking network waits should not occupy pool workers, needed
+        // for decompression and parsing.
+        std::thread(std::move(task)).detach();
+      } else {
+        ThreadPool::instance().Post(
+            stage == kParsing ?
+                TaskPriority::kNormal : TaskPriority::kInteractive,
+            std::move(task));
+      }
+    }
+  }
+}
+
+void LogFilesLoader::State::RunStage(Stage stage, size_t index) noexcept {
+  FileState& file_state = files[index];
+  bool skipped = false;
+  // After cancellation files, waiting for stages, just fail.
+  const std::error_code ec = progress.is_cancelled() ?
+      make_error_code(ErrorCodes::kCancelled) :
+      ProcessFile(stage, &file_state, &skipped);
+
+  std::lock_guard<std::mutex> lock(mutex);
+  --running_files_count[stage];
+  if (ec) {
+    if (stage == kParsing) {
+      if (!parse_error) {
+        parse_error = ec;
+      }
+    } else {
+      file_state.open_error = ec;
+    }
+  }
+  const bool finished = ec || skipped || stage == kParsing;
+  if (stage == kDecompressing || (finished && stage < kDecompressing)) {
+    --not_opened_files_count;
+  }
+  if (finished) {
+    --not_finished_files_count;
+    if (not_finished_files_count == 0) {
+      parse_result.set_value(parse_error);
+    }
+  } else {
+    waiting_files[stage + 1].push_back(index);
+  }
+  ScheduleStages();
+}
+
+std::error_code LogFilesLoader::State::ProcessFile(
+    Stage stage, FileState* file_state, bool* skipped) noexcept {
+  switch (stage) {
+    case kFetching:
+      {
+        outcome::std_result<std::filesystem::path> maybe_path =
+            files_provider->FetchLog(file_state->name, &progress);
+        if (!maybe_path) {
+          return maybe_path.error();
+        }
+        file_state->fetched_path = std::move(maybe_path.value());
+      }
+      break;
+    case kDecompressing:
+      {
+        outcome::std_result<std::unique_ptr<LogFile>> maybe_file =
+            files_provider->CreateFileForPath(
+                file_state->fetched_path, &progress);
+        if (!maybe_file) {
+          return maybe_file.error();
+        }
+        if (std::find(
+                options.skipped_paths.begin(),
+                options.skipped_paths.end(),
+                maybe_file.value()->file_path()) !=
+                    options.skipped_paths.end()) {
+          *skipped = true;
+          break;
+        }
+        if (options.enable_following) {
+          maybe_file.value()->EnableFollowing();
+        }
+        file_state->parsed_file = maybe_file.value().get();
+        file_state->file = std::move(maybe_file.value());
+      }
+      break;
+    case kParsing:
+      return file_state->parsed_file->Parse(&progress);
+    case kStagesCount:
+      assert(false);
+      break;
+  }
+  return std::error_code();
+}
+
+size_t LogFilesLoader::State::StageLimit(Stage stage) const noexcept {
+  switch (stage) {
+    case kFetching:
+      return limits.fetching_files_count;
+    case kDecompressing:
+      return limits.decompressing_files_count;
+    case kParsing:
+      return limits.parsing_files_count;
+    case kStagesCount:
+      break;
+  }
+  assert(false);
+  return 0;
+}
+
+LogFilesLoader::Limits LogFilesLoader::DefaultLimits() noexcept {
+  return Limits{
+      kFetchingFilesCount,
+      ThreadPool::instance().threads_count(),
+      kParsingFilesCount,
+      kQueuedFilesCount,
+  };
+}
+
+LogFilesLoader::LogFilesLoader(
+    LogFilesProvider* files_provider,
+    const std::vector<LogFileInfo>& files,
+    Options options,
+    const Limits& limits) noexcept
+    : state_(std::make_shared<State>()) {
+  assert(limits.fetching_files_count > 0);
+  assert(limits.decompressing_files_count > 0);
+  assert(limits.parsing_files_count > 0);
+  assert(limits.queued_files_count > 0);
+  state_->files_provider = files_provider;
+  state_->options = std::move(options);
+  state_->limits = limits;
+  state_->files.resize(files.size());
+  for (size_t i = 0; i < files.size(); ++i) {
+    state_->files[i].name = files[i].name;
+    state_->progress.AddTotalBytes(
+        Progress::Stage::kFetching, files[i].size);
+  }
+  parse_result_ = state_->parse_result.get_future();
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  state_->not_opened_files_count = state_->files.size();
+  state_->not_finished_files_count = state_->files.size();
+  if (state_->files.empty()) {
+    state_->parse_result.set_value(std::error_code());
+    return;
+  }
+  for (size_t i = 0; i < state_->files.size(); ++i) {
+    state_->waiting_files[kFetching].push_back(i);
+  }
+  state_->ScheduleStages();
+}
+
+Progress& LogFilesLoader::progress() noexcept {
+  return state_->progress;
+}
+
+std::shared_ptr<Progress> LogFilesLoader::shared_progress() const noexcept {
+  return std::shared_ptr<Progress>(state_, &state_->progress);
+}
+
+bool LogFilesLoader::is_opened() const noexcept {
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  return state_->not_opened_files_count == 0;
+}
+
+std::vector<std::unique_ptr<LogFile>>
+    LogFilesLoader::RetrieveOpenedFiles() noexcept {
+  assert(is_opened());
+  std::vector<std::unique_ptr<LogFile>> result;
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (State::FileState& file_state : state_->files) {
+    if (file_state.file) {
+      result.emplace_back(std::move(file_state.file));
+    }
+  }
+  return result;
+}
+
+std::vector<std::error_code> LogFilesLoader::open_errors() const noexcept {
+  std::vector<std::error_code> result;
+  std::lock_guard<std::mutex> lock(state_->mutex);
+  for (const State::FileState& file_state : state_->files) {
+    if (file_state.open_error) {
+      result.push_back(file_state.open_error);
+    }
+  }
+  return result;
+}
+
+std::future<std::error_code> LogFilesLoader::RetrieveParseResult() noexcept {
+  return std::move(parse_result_);
+}
+
+}  // namespace oko
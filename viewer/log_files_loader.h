@@ -0,0 +1,87 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "viewer/log_file.h"
+#include "viewer/log_files_provider.h"
+#include "viewer/progress.h"
+
+namespace oko {
+
+// Loads log files from |LogFilesProvider| in pipeline of three stages -
+// fetching (e.g. downloading), decompression and parsing. Each file
+// passes stages one by one, while different files are in different
+// stages at once, so e.g. one file is parsed while next one is
+// decompressed and others are downloaded.
+class LogFilesLoader {
+ public:
+  struct Limits {
+    // Maximal numbers of files, processed by each stage at once.
+    size_t fetching_files_count;
+    size_t decompressing_files_count;
+    size_t parsing_files_count;
+    // Maximal number of files, that passed one stage and wait for the
+    // next one. Stage does not take more files, when it is reached.
+    size_t queued_files_count;
+  };
+
+  struct Options {
+    // Enables following of loaded files, see |LogFile::EnableFollowing|.
+    bool enable_following = false;
+    // Files with these paths, e.g. already shown ones, are dropped before
+    // parsing and are not returned.
+    std::vector<std::filesystem::path> skipped_paths;
+  };
+
+  static Limits DefaultLimits() noexcept;
+
+  // Starts loading of |files| from |files_provider|, that must outlive
+  // parsing of the files.
+  LogFilesLoader(
+      LogFilesProvider* files_provider,
+      const std::vector<LogFileInfo>& files,
+      Options options,
+      const Limits& limits = DefaultLimits()) noexcept;
+
+  // Progress of all stages. Stays valid until files are parsed.
+  // Cancelling it stops all stages, then files fail with
+  // |ErrorCodes::kCancelled|.
+  Progress& progress() noexcept;
+  // Shares |progress| with stage tasks, so parsing may be cancelled after
+  // loader is destroyed.
+  std::shared_ptr<Progress> shared_progress() const noexcept;
+
+  // Returns true if every file was either opened or failed to load.
+  // Opened files may be still parsed.
+  bool is_opened() const noexcept;
+
+  // Must be called after |is_opened| returns true. Returns opened files
+  // in order of |files|. They publish records while they are parsed,
+  // see |RetrieveParseResult|.
+  std::vector<std::unique_ptr<LogFile>> RetrieveOpenedFiles() noexcept;
+
+  // Errors of files, that failed to fetch or decompress. Must be called
+  // after |is_opened| returns true.
+  std::vector<std::error_code> open_errors() const noexcept;
+
+  // Becomes ready when all opened files are parsed. Holds error of the
+  // first file, that failed to parse.
+  std::future<std::error_code> RetrieveParseResult() noexcept;
+
+ private:
+  struct State;
+  // Shared with stage tasks, since parsing continues after loader is
+  // destroyed.
+  std::shared_ptr<State> state_;
+  std::future<std::error_code> parse_result_;
+};
+
+}  // namespace oko
@@ -6,8 +6,10 @@
 
 #include <utility>
 
+#include "viewer/error_codes.h"
 #include "viewer/log_formats/memorylog_log_file.h"
 #include "viewer/log_formats/text_log_file.h"
+#include "viewer/log_index_file.h"
 #include "viewer/gzip_file_decompressor.h"
 #include "viewer/zstd_file_decompressor.h"
 
@@ -21,7 +23,7 @@ bool MatchesAnyLogFileFormat(const std::string& file_name) noexcept {
 }
 
 
-std::unique_ptr<LogFile> TryCreateFileForDecompressedPath(
+std::unique_ptr<LogFileImpl> TryCreateFileForDecompressedPath(
     std::filesystem::path file_path) noexcept {
   if (oko::TextLogFile::NameMatches(file_path.filename())) {
     return std::make_unique<oko::TextLogFile>(std::move(file_path));
@@ -40,6 +42,21 @@ LogFilesProvider::LogFilesProvider(
   decompressors_.emplace_back(std::make_unique<ZstdFileDecompressor>());
 }
 
+std::error_code LogFilesProvider::ListLogFiles(
+    const FileInfosCallback& on_file_infos,
+    const Progress* progress) noexcept {
+  outcome::std_result<std::vector<LogFileInfo>> maybe_file_infos =
+      GetLogFileInfos();
+  if (!maybe_file_infos) {
+    return maybe_file_infos.error();
+  }
+  if (progress && progress->is_cancelled()) {
+    return ErrorCodes::kCancelled;
+  }
+  on_file_infos(std::move(maybe_file_infos.value()));
+  return std::error_code();
+}
+
 bool LogFilesProvider::CanBeLogFileName(
     const std::string& file_name) const noexcept {
   if (MatchesAnyLogFileFormat(file_name)) {
@@ -60,8 +77,10 @@ bool LogFilesProvider::CanBeLogFileName(
 
 outcome::std_result<std::unique_ptr<LogFile>>
     LogFilesProvider::CreateFileForPath(
-        std::filesystem::path file_path) const noexcept {
+        std::filesystem::path file_path,
+        Progress* progress) const noexcept {
   if (auto maybe_result = TryCreateFileForDecompressedPath(file_path)) {
+    MaybeEnableIndexFile(maybe_result.get());
     return maybe_result;
   }
   for (const auto& decompressor : decompressors_) {
@@ -71,22 +90,28 @@ outcome::std_result<std::unique_ptr<LogFile>>
       continue;
     }
     auto maybe_cache_dir = cache_manager_->DirectoryForFile(
-        file_path);
+        file_path, progress);
     if (!maybe_cache_dir) {
       return maybe_cache_dir.error();
     }
-    std::error_code ec;
     std::filesystem::path dst_path =
         maybe_cache_dir.value() / *maybe_file_name;
-    if (!std::filesystem::exists(dst_path, ec) || ec) {
-      ec = decompressor->Decompress(file_path, dst_path);
-      if (ec) {
-        return ec;
-      }
+    outcome::std_result<bool> maybe_decompressed =
+        cache_manager_->GetOrCreateFile(
+            dst_path,
+            progress,
+            [&decompressor, &file_path, progress](
+                const std::filesystem::path& tmp_file_path) {
+              return decompressor->Decompress(
+                  file_path, tmp_file_path, progress);
+            });
+    if (!maybe_decompressed) {
+      return maybe_decompressed.error();
     }
-    std::unique_ptr<LogFile> result = TryCreateFileForDecompressedPath(
+    std::unique_ptr<LogFileImpl> result = TryCreateFileForDecompressedPath(
         std::move(dst_path));
     if (result) {
+      MaybeEnableIndexFile(result.get());
       return result;
     }
     assert(false);
@@ -97,4 +122,14 @@ outcome::std_result<std::unique_ptr<LogFile>>
   std::abort();
 }
 
+void LogFilesProvider::MaybeEnableIndexFile(
+    LogFileImpl* log_file) const noexcept {
+  // Files in cache are never modified, so it is safe to store their
+  // parsed records next to them.
+  if (cache_manager_->ContainsPath(log_file->file_path())) {
+    log_file->set_index_file_path(
+        LogIndexFile::PathForLogFile(log_file->file_path()));
+  }
+}
+
 }  // namespace oko
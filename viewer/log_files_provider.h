@@ -5,13 +5,15 @@
 #pragma once
 #include <boost/outcome/outcome.hpp>
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "viewer/cache_directories_manager.h"
 #include "viewer/file_decompressor.h"
-#include "viewer/log_file.h"
+#include "viewer/log_file_impl.h"
+#include "viewer/progress.h"
 
 namespace oko {
 
@@ -26,20 +28,41 @@ struct LogFileInfo {
 // and fetching their content.
 class LogFilesProvider {
  public:
+  // Receives next part of file list. Is not called concurrently.
+  using FileInfosCallback =
+      std::function<void(std::vector<LogFileInfo> file_infos)>;
+
   explicit LogFilesProvider(
       std::unique_ptr<CacheDirectoriesManager> cache_manager) noexcept;
   virtual ~LogFilesProvider() = default;
   virtual outcome::std_result<std::vector<LogFileInfo>>
       GetLogFileInfos() noexcept = 0;
-  // Returns not parsed LogFile instance.
+  // Lists the same files as |GetLogFileInfos|, passing them to
+  // |on_file_infos| by parts, as soon as they are found. Listing stops
+  // with |ErrorCodes::kCancelled| if |progress| is cancelled. Default
+  // implementation passes the whole list at once.
+  virtual std::error_code ListLogFiles(
+      const FileInfosCallback& on_file_infos,
+      const Progress* progress) noexcept;
+  // Makes log file available locally, e.g. downloads it, and returns its
+  // path. File may be still compressed, see |CreateFileForPath|.
   // |log_file_name| is a name from list, returned by |GetLogFileNames|.
-  virtual outcome::std_result<std::unique_ptr<LogFile>> FetchLog(
-      const std::string& log_file_name) noexcept = 0;
+  // Fetched bytes are reported to |progress|, if it is not nullptr.
+  // Returns |ErrorCodes::kCancelled| if |progress| is cancelled. May be
+  // called concurrently for different files.
+  virtual outcome::std_result<std::filesystem::path> FetchLog(
+      const std::string& log_file_name,
+      Progress* progress) noexcept = 0;
+  // Returns not parsed LogFile instance for path, returned by |FetchLog|.
+  // Compressed file is decompressed into cache first. May be called
+  // concurrently for different files.
+  outcome::std_result<std::unique_ptr<LogFile>> CreateFileForPath(
+      std::filesystem::path file_path,
+      Progress* progress) const noexcept;
 
  protected:
   bool CanBeLogFileName(const std::string& file_name) const noexcept;
-  outcome::std_result<std::unique_ptr<LogFile>> CreateFileForPath(
-      std::filesystem::path file_path) const noexcept;
+  void MaybeEnableIndexFile(LogFileImpl* log_file) const noexcept;
   std::vector<std::unique_ptr<FileDecompressor>> decompressors_;
   std::unique_ptr<CacheDirectoriesManager> cache_manager_;
 };
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <memory>
 #include <vector>
 #include <string>
 #include "viewer/log_view.h"
@@ -18,6 +19,15 @@ class LogFilter : public LogView {
   };
   virtual size_t filtered_out_records_count() const noexcept = 0;
   virtual Type type() const noexcept = 0;
+  // Creates filter with the same settings, applied to |parent_view|.
+  virtual std::unique_ptr<LogFilter> CloneForView(
+      const LogView* parent_view) const = 0;
+  // Same as |CloneForView|, but |parent_view| records must differ from
+  // records of the current parent view only by |change| of the root
+  // store. Only added records are checked by new filter.
+  virtual std::unique_ptr<LogFilter> CloneForChangedView(
+      const LogView* parent_view,
+      const StoreChange& change) const = 0;
 };
 
 }  // namespace oko
@@ -4,7 +4,6 @@
 
 #include "viewer/log_formats/memorylog_log_file.h"
 
-#include <algorithm>
 #include <boost/algorithm/string/predicate.hpp>
 #include <charconv>
 #include <utility>
@@ -15,92 +14,106 @@ namespace oko {
 
 namespace {
 const std::string_view kRecordStartSentinel = "\niPao2ijSahbe0F";
+
+uint64_t GetRawTimestamp(const LogRecord& record) noexcept {
+  return static_cast<uint64_t>(record.timestamp().time_since_epoch().count());
+}
+
 }  //  namespace
 
-std::error_code MemorylogLogFile::ParseImpl(
+size_t MemorylogLogFile::FindRecordStart(
     std::string_view file_data,
-    std::vector<LogRecord>* records) noexcept {
+    size_t pos) const noexcept {
+  const size_t result = file_data.find(kRecordStartSentinel, pos);
+  return result == std::string_view::npos ? file_data.size() : result;
+}
+
+void MemorylogLogFile::ParseChunk(
+    std::string_view chunk_data,
+    std::vector<LogRecord>* records) const noexcept {
   size_t pos = 0;
-  std::vector<RawRecord> raw_records;
-  while (pos < file_data.size()) {
-    size_t next_entry_start = file_data.find(kRecordStartSentinel, pos);
+  while (pos < chunk_data.size()) {
+    size_t next_entry_start = chunk_data.find(kRecordStartSentinel, pos);
     if (next_entry_start == std::string_view::npos) {
       break;
     }
     next_entry_start += kRecordStartSentinel.length();
-    size_t entry_end = file_data.find_first_of("\0\n", next_entry_start, 2);
+    size_t entry_end = chunk_data.find_first_of("\0\n", next_entry_start, 2);
     std::string_view entry_data;
     if (entry_end == std::string_view::npos) {
-      entry_data = file_data.substr(next_entry_start);
+      entry_data = chunk_data.substr(next_entry_start);
+      pos = chunk_data.size();
     } else {
-      entry_data = file_data.substr(
+      entry_data = chunk_data.substr(
           next_entry_start, entry_end - next_entry_start);
+      pos = entry_end + (chunk_data[entry_end] != '\n' ? 1 : 0);
     }
-    pos = entry_end + (file_data[entry_end] != '\n' ? 1 : 0);
     RawRecord raw_rec;
     if (FillRecord(entry_data, &raw_rec)) {
-      raw_records.emplace_back(std::move(raw_rec));
+      records->emplace_back(
+          LogRecord::time_point(
+              std::chrono::nanoseconds(raw_rec.raw_timestamp)),
+          // Memory log does not proviide distinct log levels, so add
+          // all records at "info" level.
+          LogLevel::Info,
+          raw_rec.message);
     }
   }
-  std::sort(
-      raw_records.begin(),
-      raw_records.end(),
-      [](const RawRecord& first, const RawRecord& second) {
-        return first.raw_timestamp < second.raw_timestamp;
-      });
+}
 
+std::error_code MemorylogLogFile::ConvertTimestamps(
+    std::string_view,
+    std::vector<LogRecord>* records) noexcept {
   // Get timestamps from anchor records and interpolate time on records
   // between them;
   struct AnchorRecordData {
     const LogRecord::time_point time_point;
-    const std::vector<RawRecord>::const_iterator it;
+    const uint64_t raw_timestamp;
+    const std::vector<LogRecord>::iterator it;
   };
   std::vector<AnchorRecordData> anchors;
-  for (size_t i = 0, n = raw_records.size(); i < n; ++i) {
+  for (auto it = records->begin(); it != records->end(); ++it) {
     LogRecord::time_point time_point;
-    if (ExtractTimestampFromRecord(raw_records[i], &time_point)) {
+    if (ExtractTimestampFromMessage(it->message(), &time_point)) {
       anchors.emplace_back(
-          AnchorRecordData{time_point, raw_records.cbegin() + i});
+          AnchorRecordData{time_point, GetRawTimestamp(*it), it});
     }
   }
   if (anchors.size() < 2) {
     // Can not extrapolate if we have too few anchors.
+    records->clear();
     return ErrorCodes::kFileFormatCorrupted;
   }
-  records->reserve(raw_records.size());
   // Process records before first ahchor, using region between two
   // first anchor points for extrapolation.
   ProcessRecords(
-      records,
-      RawRecordsRange(raw_records.cbegin(), anchors[0].it),
-      anchors[0].it->raw_timestamp,
+      RecordsRange(records->begin(), anchors[0].it),
+      anchors[0].raw_timestamp,
       anchors[0].time_point,
-      anchors[1].it->raw_timestamp,
+      anchors[1].raw_timestamp,
       anchors[1].time_point);
   for (size_t i = 1, n = anchors.size(); i < n; ++i) {
     ProcessRecords(
-        records,
-        RawRecordsRange(anchors[i - 1].it, anchors[i].it),
-        anchors[i - 1].it->raw_timestamp,
+        RecordsRange(anchors[i - 1].it, anchors[i].it),
+        anchors[i - 1].raw_timestamp,
         anchors[i - 1].time_point,
-        anchors[i].it->raw_timestamp,
+        anchors[i].raw_timestamp,
         anchors[i].time_point);
   }
   // Process records after last anchor, using region between
   // last two anchor points or extrapolation.
   ProcessRecords(
-      records,
-      RawRecordsRange(anchors.back().it, raw_records.cend()),
-      anchors[anchors.size() - 2].it->raw_timestamp,
+      RecordsRange(anchors.back().it, records->end()),
+      anchors[anchors.size() - 2].raw_timestamp,
       anchors[anchors.size() - 2].time_point,
-      anchors[anchors.size() - 1].it->raw_timestamp,
+      anchors[anchors.size() - 1].raw_timestamp,
       anchors[anchors.size() - 1].time_point);
   return ErrorCodes::kOk;
 }
 
 bool MemorylogLogFile::FillRecord(
     std::string_view entry_data,
-    RawRecord* record) noexcept {
+    RawRecord* record) const noexcept {
   while (!entry_data.empty() && entry_data.front() == ' ') {
     entry_data.remove_prefix(1);
   }
@@ -124,16 +137,16 @@ bool MemorylogLogFile::FillRecord(
   return true;
 }
 
-bool MemorylogLogFile::ExtractTimestampFromRecord(
-    const RawRecord& raw_rec,
-    LogRecord::time_point* result_timestamp) noexcept {
+bool MemorylogLogFile::ExtractTimestampFromMessage(
+    std::string_view message,
+    LogRecord::time_point* result_timestamp) const noexcept {
   // Assumes format like
   // "time anchor: 351638.672110347 1588316753.784846326 ...."
   static const std::string_view kTimeAnchor("time anchor: ");
-  if (!boost::algorithm::starts_with(raw_rec.message, kTimeAnchor)) {
+  if (!boost::algorithm::starts_with(message, kTimeAnchor)) {
     return false;
   }
-  const size_t next_space = raw_rec.message.find(' ', kTimeAnchor.size());
+  const size_t next_space = message.find(' ', kTimeAnchor.size());
   if (next_space == std::string_view::npos) {
     return false;
   }
@@ -141,18 +154,18 @@ bool MemorylogLogFile::ExtractTimestampFromRecord(
   // Now range points to timestamp - seconds.nanoseconds.
   uint64_t seconds = 0, nanoseconds = 0;
   auto from_chars_res = std::from_chars(
-      raw_rec.message.data() + next_space + 1,
-      raw_rec.message.data() + raw_rec.message.size(),
+      message.data() + next_space + 1,
+      message.data() + message.size(),
       seconds);
   if (from_chars_res.ec != std::errc() ||
-      from_chars_res.ptr == raw_rec.message.end() ||
+      from_chars_res.ptr == message.end() ||
       *from_chars_res.ptr != '.') {
     return false;
   }
   const char* ns_string_ptr = from_chars_res.ptr + 1;
   from_chars_res = std::from_chars(
       ns_string_ptr,
-      raw_rec.message.data() + raw_rec.message.size(),
+      message.data() + message.size(),
       nanoseconds);
   if (from_chars_res.ec != std::errc() ||
       *from_chars_res.ptr != ' ') {
@@ -165,48 +178,36 @@ bool MemorylogLogFile::ExtractTimestampFromRecord(
 }
 
 void MemorylogLogFile::ProcessRecords(
-    std::vector<LogRecord>* records,
-    const boost::iterator_range<std::vector<RawRecord>::const_iterator>
-        added_region,
+    RecordsRange region,
     const uint64_t first_raw_time_stamp,
     const LogRecord::time_point first_time_point,
     const uint64_t second_raw_time_stamp,
-    const LogRecord::time_point second_time_point) {
-  if (added_region.empty()) {
+    const LogRecord::time_point second_time_point) noexcept {
+  if (region.empty()) {
     return;
   }
   const auto tp_duration = second_time_point - first_time_point;
   uint64_t raw_timestamp_duration =
       second_raw_time_stamp - first_raw_time_stamp;
-  if (added_region.front().raw_timestamp >= first_raw_time_stamp) {
+  if (GetRawTimestamp(region.front()) >= first_raw_time_stamp) {
     // Our region lies after first pivot time point, so we can use duration
     // after first point without risk of overflow.
-    for (const RawRecord& raw_rec : added_region) {
+    for (LogRecord& rec : region) {
       const LogRecord::time_point tp =
            first_time_point + (
-               (raw_rec.raw_timestamp - first_raw_time_stamp) * tp_duration) /
+               (GetRawTimestamp(rec) - first_raw_time_stamp) * tp_duration) /
                    raw_timestamp_duration;
-      records->emplace_back(
-          tp,
-          // Memory log does not proviide distinct log levels, so add
-          // all records at "info" level.
-          LogLevel::Info,
-          raw_rec.message);
+      rec = LogRecord(tp, rec.log_level(), rec.message());
     }
-  } else if (added_region.back().raw_timestamp <= first_raw_time_stamp) {
+  } else if (GetRawTimestamp(region.back()) <= first_raw_time_stamp) {
     // Our region lies before first pivot time point, so we can use duration
     // to first point without risk of overflow.
-    for (const RawRecord& raw_rec : added_region) {
+    for (LogRecord& rec : region) {
       const LogRecord::time_point tp =
            first_time_point - (
-               (first_raw_time_stamp - raw_rec.raw_timestamp) * tp_duration) /
+               (first_raw_time_stamp - GetRawTimestamp(rec)) * tp_duration) /
                    raw_timestamp_duration;
-      records->emplace_back(
-          tp,
-          // Memory log does not proviide distinct log levels, so add
-          // all records at "info" level.
-          LogLevel::Info,
-          raw_rec.message);
+      rec = LogRecord(tp, rec.log_level(), rec.message());
     }
   } else {
     // first time point must not fall inside added region.
@@ -23,7 +23,16 @@ class MemorylogLogFile : public LogFileImpl {
   static bool NameMatches(const std::string& file_name) noexcept;
 
  private:
-  std::error_code ParseImpl(
+  size_t FindRecordStart(
+      std::string_view file_data,
+      size_t pos) const noexcept override;
+  void ParseChunk(
+      std::string_view chunk_data,
+      std::vector<LogRecord>* records) const noexcept override;
+  // Raw timestamps are memorylog counter values. Real timestamps are
+  // interpolated between "time anchor" records, that may be located in
+  // any part of the file.
+  std::error_code ConvertTimestamps(
       std::string_view file_data,
       std::vector<LogRecord>* records) noexcept override;
 
@@ -31,24 +40,24 @@ class MemorylogLogFile : public LogFileImpl {
     uint64_t raw_timestamp;
     std::string_view message;
   };
-  bool FillRecord(std::string_view entry_data, RawRecord* record) noexcept;
-  bool ExtractTimestampFromRecord(
-      const RawRecord&,
-      LogRecord::time_point* result_timestamp) noexcept;
-  using RawRecordsRange =
-      boost::iterator_range<std::vector<RawRecord>::const_iterator>;
-  // Adds records from range |added_region|,
+  bool FillRecord(
+      std::string_view entry_data, RawRecord* record) const noexcept;
+  bool ExtractTimestampFromMessage(
+      std::string_view message,
+      LogRecord::time_point* result_timestamp) const noexcept;
+  using RecordsRange =
+      boost::iterator_range<std::vector<LogRecord>::iterator>;
+  // Converts raw timestamps of records from range |region|,
   // using two anchor time points data.
   // first_raw_time_stamp must be strictly less then second_raw_time_stamp.
-  // Assumes that all records from |added_region| are ordered by raw_timestamp.
-  // First anchor time point must not lie in the middle of added region.
+  // Assumes that all records from |region| are ordered by raw timestamp.
+  // First anchor time point must not lie in the middle of the region.
   void ProcessRecords(
-      std::vector<LogRecord>* records,
-      RawRecordsRange added_region,
+      RecordsRange region,
       const uint64_t first_raw_time_stamp,
       const LogRecord::time_point first_time_point,
       const uint64_t second_raw_time_stamp,
-      const LogRecord::time_point second_time_point);
+      const LogRecord::time_point second_time_point) noexcept;
 };
 
 }  // namespace oko
@@ -34,16 +34,43 @@ inline void Trim(std::string_view& str, Predicate p) noexcept {
 
 }  // namespace
 
-// Class for parsing log files in some proprientary project.
-std::error_code TextLogFile::ParseImpl(
+size_t TextLogFile::FindRecordStart(
     std::string_view file_data,
-    std::vector<LogRecord>* records) noexcept {
-  nsec_counter_base_ = std::nullopt;
-  size_t pos = 0;
-  std::optional<RawRecordInfo> pending_record;
+    size_t pos) const noexcept {
+  if (pos > 0 && pos < file_data.size() && file_data[pos - 1] != '\n') {
+    // Skip rest of the line, |pos| points into.
+    pos = file_data.find('\n', pos);
+    if (pos == std::string_view::npos) {
+      return file_data.size();
+    }
+    ++pos;
+  }
+  // Lines that can not be parsed are continuations of previous record
+  // message, so record starts only at line that can be parsed.
+  RawRecordInfo info;
   while (pos < file_data.size()) {
     size_t line_end = file_data.find('\n', pos);
-    std::string_view next_line = file_data.substr(
+    std::string_view line = file_data.substr(
+        pos, line_end == std::string_view::npos ? line_end : line_end - pos);
+    if (ParseLine(line, info)) {
+      return pos;
+    }
+    if (line_end == std::string_view::npos) {
+      break;
+    }
+    pos = line_end + 1;
+  }
+  return file_data.size();
+}
+
+void TextLogFile::ParseChunk(
+    std::string_view chunk_data,
+    std::vector<LogRecord>* records) const noexcept {
+  size_t pos = 0;
+  std::optional<RawRecordInfo> pending_record;
+  while (pos < chunk_data.size()) {
+    size_t line_end = chunk_data.find('\n', pos);
+    std::string_view next_line = chunk_data.substr(
         pos, line_end == std::string_view::npos ? line_end : line_end - pos);
 
     RawRecordInfo next_record;
@@ -72,19 +99,44 @@ std::error_code TextLogFile::ParseImpl(
   if (pending_record) {
     AddRecord(records, pending_record.value());
   }
-  // Some lines may be misordered, so we must sort.
-  std::sort(
-      records->begin(),
-      records->end(),
-      [](const LogRecord& first, const LogRecord& second) {
-        return first.timestamp() < second.timestamp();
-      });
+}
+
+std::error_code TextLogFile::ConvertTimestamps(
+    std::string_view file_data,
+    std::vector<LogRecord>* records) noexcept {
+  nsec_counter_base_ = std::nullopt;
+  const size_t first_record_start = FindRecordStart(file_data, 0);
+  if (first_record_start >= file_data.size()) {
+    return ErrorCodes::kOk;
+  }
+  size_t line_end = file_data.find('\n', first_record_start);
+  if (line_end == std::string_view::npos) {
+    line_end = file_data.size();
+  }
+  RawRecordInfo info;
+  if (!ParseLine(
+          file_data.substr(first_record_start, line_end - first_record_start),
+          info)) {
+    assert(false);
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  // Assume first record in file fits nseconds perfectly, and calculate
+  // all records timestamps based on it.
+  nsec_counter_base_ = LogRecord::time_point {} +
+      std::chrono::seconds(info.sec) + std::chrono::milliseconds(info.msec) -
+      std::chrono::nanoseconds(info.nsec_counter);
+  const LogRecord::time_point::duration base_offset =
+      nsec_counter_base_->time_since_epoch();
+  for (LogRecord& rec : *records) {
+    rec = LogRecord(
+        rec.timestamp() + base_offset, rec.log_level(), rec.message());
+  }
   return ErrorCodes::kOk;
 }
 
 bool TextLogFile::ParseLine(
     std::string_view line,
-    TextLogFile::RawRecordInfo& info) noexcept {
+    TextLogFile::RawRecordInfo& info) const noexcept {
   // Assumes format:
   // nanoseconds_counter | unused_character seconds.ms YYYY-MM-dd hh:mm:ss time_zone |level | message
   info.nsec_counter = 0;
@@ -169,22 +221,14 @@ bool TextLogFile::ParseLine(
 
 void TextLogFile::AddRecord(
     std::vector<LogRecord>* records,
-    const RawRecordInfo& info) noexcept {
-  LogRecord::time_point current_time_point;
-  if (!nsec_counter_base_) {
-    // Assume first records fit nseconds perfectly, and calculate
-    // all subsequent records timestamps based on it.
-    current_time_point = LogRecord::time_point {} +
-        std::chrono::seconds(info.sec) + std::chrono::milliseconds(info.msec);
-    nsec_counter_base_ = current_time_point -
-        std::chrono::nanoseconds(info.nsec_counter);
-  } else {
-    current_time_point = *nsec_counter_base_ +
-        std::chrono::nanoseconds(info.nsec_counter);
-  }
+    const RawRecordInfo& info) const noexcept {
+  // Raw timestamp is just nanoseconds counter value, see
+  // |ConvertTimestamps|.
+  const LogRecord::time_point raw_time_point = LogRecord::time_point {} +
+      std::chrono::nanoseconds(info.nsec_counter);
   std::string_view msg = info.message;
   Trim(msg, boost::is_any_of(" \n\r"));
-  records->emplace_back(current_time_point, info.level, msg);
+  records->emplace_back(raw_time_point, info.level, msg);
 }
 
 // static
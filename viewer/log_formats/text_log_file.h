@@ -22,9 +22,21 @@ class TextLogFile : public LogFileImpl {
   static bool NameMatches(const std::string& file_name) noexcept;
 
  private:
-  std::error_code ParseImpl(
+  size_t FindRecordStart(
+      std::string_view file_data,
+      size_t pos) const noexcept override;
+  void ParseChunk(
+      std::string_view chunk_data,
+      std::vector<LogRecord>* records) const noexcept override;
+  // Raw timestamps are values of nanoseconds counter, so conversion
+  // just adds |nsec_counter_base_| to them.
+  std::error_code ConvertTimestamps(
       std::string_view file_data,
       std::vector<LogRecord>* records) noexcept override;
+  // Conversion needs only the first record of file.
+  bool CanFollow() const noexcept override {
+    return true;
+  }
 
   struct RawRecordInfo {
     uint64_t sec;
@@ -33,10 +45,11 @@ class TextLogFile : public LogFileImpl {
     LogLevel level;
     std::string_view message;
   };
-  bool ParseLine(std::string_view line, RawRecordInfo& info) noexcept;
+  bool ParseLine(
+      std::string_view line, RawRecordInfo& info) const noexcept;
   void AddRecord(
       std::vector<LogRecord>* records,
-      const RawRecordInfo& info) noexcept;
+      const RawRecordInfo& info) const noexcept;
 
   std::optional<LogRecord::time_point> nsec_counter_base_;
 };
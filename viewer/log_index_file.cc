@@ -0,0 +1,209 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/log_index_file.h"
+
+#include <unistd.h>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "viewer/error_codes.h"
+
+namespace oko {
+
+namespace {
+
+const char kIndexFileExtension[] = ".okoidx";
+const char kMagic[8] = {'O', 'K', 'O', 'I', 'D', 'X', '\0', '\0'};
+const uint32_t kVersion = 2;
+// Number of records, buffered in memory before writing them to file.
+const size_t kWriteBatchSize = 64 * 1024;
+
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t log_file_size;
+  int64_t log_file_mtime;
+  uint64_t records_count;
+  // Identity of written index, that other indexes of the log file store,
+  // see |TrigramIndex|.
+  uint64_t index_id;
+};
+
+struct IndexRecord {
+  int64_t timestamp;
+  uint64_t message_offset;
+  uint32_t message_length;
+  uint32_t log_level;
+};
+
+static_assert(sizeof(IndexHeader) == 48, "Unexpected padding in header");
+static_assert(sizeof(IndexRecord) == 24, "Unexpected padding in record");
+
+uint64_t GenerateIndexId() noexcept {
+  std::random_device random_device;
+  std::uniform_int_distribution<uint64_t> distribution(
+      1, std::numeric_limits<uint64_t>::max());
+  return distribution(random_device);
+}
+
+}  // namespace
+
+// static
+outcome::std_result<int64_t> LogIndexFile::GetLogFileMTime(
+    const std::filesystem::path& log_file_path) noexcept {
+  std::error_code ec;
+  auto mtime = std::filesystem::last_write_time(log_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      mtime.time_since_epoch()).count();
+}
+
+// static
+std::filesystem::path LogIndexFile::PathForLogFile(
+    const std::filesystem::path& log_file_path) noexcept {
+  std::filesystem::path result = log_file_path;
+  result.concat(kIndexFileExtension);
+  return result;
+}
+
+// static
+std::error_code LogIndexFile::Write(
+    const std::filesystem::path& index_file_path,
+    const std::filesystem::path& log_file_path,
+    std::string_view log_file_data,
+    const RecordStore& records,
+    uint64_t* index_id) noexcept {
+  auto maybe_mtime = GetLogFileMTime(log_file_path);
+  if (!maybe_mtime) {
+    return maybe_mtime.error();
+  }
+  IndexHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.record_size = sizeof(IndexRecord);
+  header.log_file_size = log_file_data.size();
+  header.log_file_mtime = maybe_mtime.value();
+  header.records_count = records.size();
+  header.index_id = GenerateIndexId();
+
+  std::filesystem::path tmp_file_path = index_file_path;
+  // Other processes may write index of the same file at once.
+  tmp_file_path.concat(".tmp" + std::to_string(getpid()));
+  {
+    std::ofstream dst_file(
+        tmp_file_path,
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!dst_file.is_open()) {
+      return std::error_code(errno, std::generic_category());
+    }
+    dst_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    std::vector<IndexRecord> batch;
+    batch.reserve(kWriteBatchSize);
+    for (size_t i = 0, n = records.size(); i < n; ++i) {
+      const std::string_view message = records.message(i);
+      batch.emplace_back(IndexRecord{
+          records.timestamp(i).time_since_epoch().count(),
+          static_cast<uint64_t>(message.data() - log_file_data.data()),
+          static_cast<uint32_t>(message.size()),
+          static_cast<uint32_t>(records.log_level(i))});
+      if (batch.size() == kWriteBatchSize || i + 1 == n) {
+        dst_file.write(
+            reinterpret_cast<const char*>(batch.data()),
+            batch.size() * sizeof(IndexRecord));
+        batch.clear();
+      }
+    }
+    if (!dst_file) {
+      std::error_code ec;
+      std::filesystem::remove(tmp_file_path, ec);
+      return ErrorCodes::kFailedWriteFile;
+    }
+  }
+  std::error_code ec;
+  std::filesystem::rename(tmp_file_path, index_file_path, ec);
+  if (!ec) {
+    *index_id = header.index_id;
+  }
+  return ec;
+}
+
+// static
+std::error_code LogIndexFile::Read(
+    const std::filesystem::path& index_file_path,
+    const std::filesystem::path& log_file_path,
+    std::string_view log_file_data,
+    RecordStore* records,
+    uint64_t* index_id) noexcept {
+  std::error_code ec;
+  const auto index_file_size = std::filesystem::file_size(
+      index_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  if (index_file_size < sizeof(IndexHeader)) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  auto maybe_mtime = GetLogFileMTime(log_file_path);
+  if (!maybe_mtime) {
+    return maybe_mtime.error();
+  }
+  boost::iostreams::mapped_file_source mapped_file;
+  try {
+    // Throws if file was removed or truncated after its size was checked.
+    mapped_file.open(index_file_path);
+  } catch (const std::exception&) {
+    return ErrorCodes::kFailedMapFile;
+  }
+  if (!mapped_file.is_open()) {
+    return ErrorCodes::kFailedMapFile;
+  }
+  if (mapped_file.size() != index_file_size) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  IndexHeader header;
+  std::memcpy(&header, mapped_file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      header.record_size != sizeof(IndexRecord) ||
+      header.log_file_size != log_file_data.size() ||
+      header.log_file_mtime != maybe_mtime.value() ||
+      header.index_id == 0 ||
+      header.records_count !=
+          (index_file_size - sizeof(IndexHeader)) / sizeof(IndexRecord)) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  const IndexRecord* index_records = reinterpret_cast<const IndexRecord*>(
+      mapped_file.data() + sizeof(IndexHeader));
+  records->clear();
+  records->reserve(header.records_count);
+  for (uint64_t i = 0; i < header.records_count; ++i) {
+    const IndexRecord& rec = index_records[i];
+    if (rec.message_offset > log_file_data.size() ||
+        rec.message_length > log_file_data.size() - rec.message_offset ||
+        rec.log_level <= static_cast<uint32_t>(LogLevel::Invalid) ||
+        rec.log_level >= static_cast<uint32_t>(LogLevel::AfterLast)) {
+      records->clear();
+      return ErrorCodes::kFileFormatCorrupted;
+    }
+    records->Append(
+        LogRecord::time_point(std::chrono::nanoseconds(rec.timestamp)),
+        static_cast<LogLevel>(rec.log_level),
+        log_file_data.substr(rec.message_offset, rec.message_length));
+  }
+  *index_id = header.index_id;
+  return ErrorCodes::kOk;
+}
+
+}  // namespace oko
@@ -0,0 +1,55 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <boost/outcome/result.hpp>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+
+#include "viewer/record_store.h"
+
+namespace oko {
+
+namespace outcome = BOOST_OUTCOME_V2_NAMESPACE;
+
+// Binary "sidecar" file, that stores offset, length, level and timestamp
+// of every parsed record of some log file. Allows reopening log file
+// without parsing it again.
+class LogIndexFile {
+ public:
+  // Returns path of index file for log file |log_file_path|.
+  static std::filesystem::path PathForLogFile(
+      const std::filesystem::path& log_file_path) noexcept;
+
+  // Writes index of |records|, which must point into |log_file_data|.
+  // |log_file_path| is used to save information allowing detect
+  // stale index files. Stores unique non-zero identity of written index
+  // to |index_id|.
+  static std::error_code Write(
+      const std::filesystem::path& index_file_path,
+      const std::filesystem::path& log_file_path,
+      std::string_view log_file_data,
+      const RecordStore& records,
+      uint64_t* index_id) noexcept;
+
+  // Appends records from index file to |records|, that must be created
+  // for |log_file_data|, and stores identity of the index to |index_id|.
+  // Fails if index is missed, corrupted or was built for other version
+  // of the log file.
+  static std::error_code Read(
+      const std::filesystem::path& index_file_path,
+      const std::filesystem::path& log_file_path,
+      std::string_view log_file_data,
+      RecordStore* records,
+      uint64_t* index_id) noexcept;
+
+  // Returns modification time of the log file in nanoseconds. Index files
+  // store it to detect that log file was changed.
+  static outcome::std_result<int64_t> GetLogFileMTime(
+      const std::filesystem::path& log_file_path) noexcept;
+};
+
+}  // namespace oko
@@ -6,21 +6,56 @@
 
 #include <utility>
 
+#include "viewer/select_records.h"
+
 namespace oko {
 
 LogLevelFilter::LogLevelFilter(
     const LogView* parent_view,
-    std::unordered_set<LogLevel> levels_to_include)
+    std::unordered_set<LogLevel> levels_to_include,
+    Progress* progress)
   : levels_to_include_(std::move(levels_to_include)) {
-  const std::vector<LogRecord>& parent_records = parent_view->GetRecords();
-  filtered_records_.reserve(parent_records.size());
-  for (const LogRecord& rec : parent_records) {
-    if (levels_to_include_.count(rec.log_level()) != 0) {
-      filtered_records_.emplace_back(rec);
-    } else {
-      ++filtered_records_count_;
-    }
-  }
+  const RecordsAccessor parent_records = parent_view->GetRecords();
+  store_ = &parent_records.store();
+  selection_ = SelectRecords(
+      parent_records,
+      [this](size_t store_index) {
+        return levels_to_include_.count(store_->log_level(store_index)) != 0;
+      },
+      nullptr,
+      progress);
+  filtered_records_count_ = parent_records.size() - selection_.size();
+}
+
+LogLevelFilter::LogLevelFilter(
+    const LogView* parent_view,
+    const LogLevelFilter& other,
+    const StoreChange& change)
+  : levels_to_include_(other.levels_to_include_) {
+  const RecordsAccessor parent_records = parent_view->GetRecords();
+  store_ = &parent_records.store();
+  selection_ = other.selection_.ApplyChange(
+      change,
+      SelectAddedRecords(
+          parent_records,
+          change.added,
+          [this](size_t store_index) {
+            return levels_to_include_.count(
+                store_->log_level(store_index)) != 0;
+          }));
+  filtered_records_count_ = parent_records.size() - selection_.size();
+}
+
+std::unique_ptr<LogFilter> LogLevelFilter::CloneForView(
+    const LogView* parent_view) const {
+  return std::make_unique<LogLevelFilter>(
+      parent_view, levels_to_include_, nullptr);
+}
+
+std::unique_ptr<LogFilter> LogLevelFilter::CloneForChangedView(
+    const LogView* parent_view,
+    const StoreChange& change) const {
+  return std::make_unique<LogLevelFilter>(parent_view, *this, change);
 }
 
 }  // namespace oko
@@ -7,18 +7,28 @@
 #include <vector>
 
 #include "viewer/log_filter.h"
+#include "viewer/progress.h"
 
 namespace oko {
 
 // Filters records based on logging levels.
 class LogLevelFilter : public LogFilter {
  public:
+  // Checked records are reported to |progress|, if it is not nullptr.
+  // If |progress| is cancelled, filter is incomplete and must be dropped.
   LogLevelFilter(
       const LogView* parent_view,
-      std::unordered_set<LogLevel> levels_to_include);
+      std::unordered_set<LogLevel> levels_to_include,
+      Progress* progress);
+  // Creates filter with settings of |other|, which records are changed
+  // by |change|. See |CloneForChangedView|.
+  LogLevelFilter(
+      const LogView* parent_view,
+      const LogLevelFilter& other,
+      const StoreChange& change);
 
-  const std::vector<LogRecord>& GetRecords() const noexcept override {
-    return filtered_records_;
+  RecordsAccessor GetRecords() const noexcept override {
+    return RecordsAccessor(store_, &selection_);
   }
 
   size_t filtered_out_records_count() const noexcept override {
@@ -33,8 +43,16 @@ class LogLevelFilter : public LogFilter {
     return Type::kLevel;
   }
 
+  std::unique_ptr<LogFilter> CloneForView(
+      const LogView* parent_view) const override;
+  std::unique_ptr<LogFilter> CloneForChangedView(
+      const LogView* parent_view,
+      const StoreChange& change) const override;
+
  private:
-  std::vector<LogRecord> filtered_records_;
+  // Store of the root view, shared by all filters in the chain.
+  const RecordStore* store_;
+  RecordSelection selection_;
   const std::unordered_set<LogLevel> levels_to_include_;
   size_t filtered_records_count_ = 0;
 };
@@ -4,29 +4,73 @@
 
 #include "viewer/log_pattern_filter.h"
 
+#include "viewer/select_records.h"
+
 namespace oko {
 
 LogPatternFilter::LogPatternFilter(
     const LogView* parent_view,
     const std::string& pattern,
-    bool is_include_filter)
-    : pattern_(pattern),
+    bool is_include_filter,
+    const TrigramIndex* text_index,
+    Progress* progress)
+    : matcher_(pattern),
       is_include_filter_(is_include_filter) {
-  const std::vector<LogRecord>& parent_records = parent_view->GetRecords();
-  filtered_records_.reserve(parent_records.size());
-  for (const LogRecord& rec : parent_records) {
-    const bool has_pattern =
-        rec.message().find(pattern.c_str()) != std::string_view::npos;
-    if (has_pattern == is_include_filter) {
-      filtered_records_.emplace_back(rec);
-    } else {
-      ++filtered_out_records_count_;
-    }
+  const RecordsAccessor parent_records = parent_view->GetRecords();
+  store_ = &parent_records.store();
+  TrigramIndex::Candidates candidates;
+  if (text_index && text_index->records_count() == store_->size()) {
+    candidates = text_index->FindCandidates(pattern);
   }
+  selection_ = SelectRecords(
+      parent_records,
+      [this, &candidates](size_t store_index) {
+        const bool has_pattern = candidates.MayContain(store_index) &&
+            matcher_.Matches(store_->message(store_index));
+        return has_pattern == is_include_filter_;
+      },
+      nullptr,
+      progress);
+  filtered_out_records_count_ = parent_records.size() - selection_.size();
+}
+
+LogPatternFilter::LogPatternFilter(
+    const LogView* parent_view,
+    const LogPatternFilter& other,
+    const StoreChange& change)
+    : matcher_(other.matcher_),
+      is_include_filter_(other.is_include_filter_) {
+  const RecordsAccessor parent_records = parent_view->GetRecords();
+  store_ = &parent_records.store();
+  selection_ = other.selection_.ApplyChange(
+      change,
+      SelectAddedRecords(
+          parent_records,
+          change.added,
+          [this](size_t store_index) {
+            const bool has_pattern =
+                matcher_.Matches(store_->message(store_index));
+            return has_pattern == is_include_filter_;
+          }));
+  filtered_out_records_count_ = parent_records.size() - selection_.size();
 }
 
-const std::vector<LogRecord>& LogPatternFilter::GetRecords() const noexcept {
-  return filtered_records_;
+RecordsAccessor LogPatternFilter::GetRecords() const noexcept {
+  return RecordsAccessor(store_, &selection_);
+}
+
+std::unique_ptr<LogFilter> LogPatternFilter::CloneForView(
+    const LogView* parent_view) const {
+  // Text index is built for store of the original parent, and can not be
+  // used with other views.
+  return std::make_unique<LogPatternFilter>(
+      parent_view, matcher_.pattern(), is_include_filter_, nullptr, nullptr);
+}
+
+std::unique_ptr<LogFilter> LogPatternFilter::CloneForChangedView(
+    const LogView* parent_view,
+    const StoreChange& change) const {
+  return std::make_unique<LogPatternFilter>(parent_view, *this, change);
 }
 
 }  // namespace oko
@@ -6,17 +6,32 @@
 #include <vector>
 #include <string>
 #include "viewer/log_filter.h"
+#include "viewer/progress.h"
+#include "viewer/substring_matcher.h"
+#include "viewer/trigram_index.h"
 
 namespace oko {
 
 // Filters records based on pattern.
 class LogPatternFilter : public LogFilter {
  public:
+  // |text_index| may be nullptr. If provided, it must be built for
+  // records of the store, that |parent_view| records belong to.
+  // Checked records are reported to |progress|, if it is not nullptr.
+  // If |progress| is cancelled, filter is incomplete and must be dropped.
   LogPatternFilter(
       const LogView* parent_view,
       const std::string& pattern,
-      bool is_include_filter);
-  const std::vector<LogRecord>& GetRecords() const noexcept override;
+      bool is_include_filter,
+      const TrigramIndex* text_index,
+      Progress* progress);
+  // Creates filter with settings of |other|, which records are changed
+  // by |change|. See |CloneForChangedView|.
+  LogPatternFilter(
+      const LogView* parent_view,
+      const LogPatternFilter& other,
+      const StoreChange& change);
+  RecordsAccessor GetRecords() const noexcept override;
   size_t filtered_out_records_count() const noexcept override {
     return filtered_out_records_count_;
   }
@@ -26,12 +41,20 @@ class LogPatternFilter : public LogFilter {
   }
 
   const std::string& pattern() const noexcept {
-    return pattern_;
+    return matcher_.pattern();
   }
 
+  std::unique_ptr<LogFilter> CloneForView(
+      const LogView* parent_view) const override;
+  std::unique_ptr<LogFilter> CloneForChangedView(
+      const LogView* parent_view,
+      const StoreChange& change) const override;
+
  private:
-  std::vector<LogRecord> filtered_records_;
-  const std::string pattern_;
+  // Store of the root view, shared by all filters in the chain.
+  const RecordStore* store_;
+  RecordSelection selection_;
+  const SubstringMatcher matcher_;
   const bool is_include_filter_;
   size_t filtered_out_records_count_ = 0;
 };
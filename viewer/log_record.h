@@ -5,13 +5,15 @@
 #pragma once
 #include <cassert>
 #include <chrono>
+#include <cstdint>
 #include <ostream>
 #include <string_view>
 
 
 namespace oko {
 
-enum class LogLevel {
+// Single byte, since level is stored for every record.
+enum class LogLevel : uint8_t {
   Invalid,  // Never appears in LogRecords.
   Debug,
   Info,
@@ -3,8 +3,7 @@
 // found in the LICENSE file.
 
 #pragma once
-#include <vector>
-#include "viewer/log_record.h"
+#include "viewer/record_store.h"
 
 namespace oko {
 
@@ -15,7 +14,7 @@ class LogView {
   virtual ~LogView() = default;
 
   // Returned log records must be ordered by their timestamp.
-  virtual const std::vector<LogRecord>& GetRecords() const noexcept = 0;
+  virtual RecordsAccessor GetRecords() const noexcept = 0;
 };
 
 }  // namespace oko
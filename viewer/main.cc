@@ -3,22 +3,28 @@
 // found in the LICENSE file.
 #include <ncurses.h>
 
+#include <algorithm>
 #include <boost/format.hpp>
 #include <boost/program_options.hpp>
 #include <chrono>
 #include <filesystem>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <optional>
 
 #include "viewer/app_model.h"
 #include "viewer/cache_directories_manager.h"
 #include "viewer/directory_log_files_provider.h"
 #include "viewer/log_formats/memorylog_log_file.h"
+#include "viewer/log_files_follower.h"
+#include "viewer/log_files_loader.h"
 #include "viewer/log_formats/text_log_file.h"
 #include "viewer/s3_log_files_provider.h"
+#include "viewer/thread_pool.h"
 #include "viewer/ui/add_level_filter_dialog.h"
 #include "viewer/ui/add_pattern_filter_dialog.h"
+#include "viewer/ui/go_to_search_hit_dialog.h"
 #include "viewer/ui/go_to_timestamp_dialog.h"
 #include "viewer/ui/log_files_window.h"
 #include "viewer/ui/message_window.h"
@@ -31,6 +37,12 @@
 
 namespace po = boost::program_options;
 
+// How often screen is updated while files are parsed, indexed or searched.
+static const int kParsingRefreshIntervalMs = 300;
+// How often file chooser shows newly listed files.
+static const int kListingRefreshIntervalMs = 300;
+static const uint64_t kBytesInMegabyte = 1024 * 1024;
+
 static const char kMainHelpMessage[] = (
   "F1              Show this help message\n"
   "F2, =           Remove all filters\n"
@@ -41,10 +53,15 @@ static const char kMainHelpMessage[] = (
   "F7, /           Search for pattern\n"
   "F8, n           Search next pattern occurence\n"
   "N               Search prev pattern occurence\n"
+  "#               Go to search match by its number\n"
+  "Esc             Cancel running search\n"
   "F9, v           Add log level filter\n"
   "F10, m          Toggle marking mode\n"
   "F11, q          Exit\n"
   "F12, t          Toggle time format\n"
+  "o               Open more files\n"
+  "c               Show cache statistics\n"
+  "x               Close file of selected record\n"
   "j, down arrow   One line down\n"
   "k, up arrow     One line up\n"
   "h, left arrow   Scroll left\n"
@@ -77,19 +94,213 @@ void ConfigureFunctionLabels(oko::FunctionBarWindow& wnd) noexcept {
   wnd.SetLabel(12, "Toggle time format");
 }
 
-void ShowFiles(std::vector<std::unique_ptr<oko::LogFile>> files) {
-  oko::AppModel model(std::move(files));
+// Parsing of files, that were opened at once.
+struct ParseTask {
+  // Becomes ready when all files are parsed.
+  std::future<std::error_code> result;
+  // Cancelling it stops parsing. Shared with parsing tasks.
+  std::shared_ptr<oko::Progress> progress;
+};
+
+// Returns files, chosen by user. They are parsed in background by
+// |parse_task|.
+std::vector<std::unique_ptr<oko::LogFile>> RunChooseFile(
+    oko::LogFilesProvider& files_provider,
+    oko::LogFilesLoader::Options loader_options,
+    ParseTask* parse_task) noexcept {
+  int num_rows = 0, num_columns = 0;
+  getmaxyx(stdscr, num_rows, num_columns);
+  oko::LogFilesWindow window(
+      &files_provider,
+      std::move(loader_options),
+      0, 0, num_rows - oko::FunctionBarWindow::kRows, num_columns);
+  oko::FunctionBarWindow func_window(
+      num_rows - oko::FunctionBarWindow::kRows, 0, num_columns);
+  func_window.SetLabel(1, "Help");
+  func_window.SetLabel(7, "Search");
+  func_window.SetLabel(8, "SearchNext");
+  func_window.SetLabel(9, "SearchPrev");
+  func_window.SetLabel(10, "ToggleMark");
+  func_window.SetLabel(11, "Quit");
+  std::unique_ptr<oko::DialogWindow> current_dialog;
+
+  while (!window.finished()) {
+    timeout(window.is_listing() ? kListingRefreshIntervalMs : -1);
+    window.Display();
+    func_window.Display();
+    if (current_dialog) {
+      current_dialog->Display();
+    }
+    int key = getch();
+    if (key == ERR) {
+      window.Update();
+      continue;
+    }
+    if (current_dialog) {
+      current_dialog->HandleKeyPress(key);
+    } else {
+      switch (key) {
+        case KEY_F(1):
+          oko::MessageWindow::PostSync(kFileChooserHelpMessage);
+          break;
+        case 'q':
+        case KEY_F(11):
+          timeout(-1);
+          return {};
+        case '/':
+        case KEY_F(7):
+          current_dialog = std::make_unique<oko::SearchLogDialog>(&window);
+          break;
+        case 'n':
+        case KEY_F(8):
+          window.SearchNextEntry();
+          break;
+        case 'N':
+        case KEY_F(9):
+          window.SearchPrevEntry();
+          break;
+        default:
+          window.HandleKeyPress(key);
+      }
+    }
+    if (current_dialog && current_dialog->finished()) {
+      current_dialog.reset();
+    }
+    window.Update();
+  }
+  timeout(-1);
+  parse_task->result = window.RetrieveParseResult();
+  parse_task->progress = window.RetrieveParseProgress();
+  return window.RetrieveFetchedFiles();
+}
+
+// Parses |file| in background.
+ParseTask StartParsing(oko::LogFile* file) {
+  ParseTask result;
+  result.progress = std::make_shared<oko::Progress>();
+  result.result = oko::ThreadPool::instance().Submit(
+      oko::TaskPriority::kNormal,
+      [file, progress = result.progress] {
+        return file->Parse(progress.get());
+      });
+  return result;
+}
+
+// Cancels |parse_tasks| and waits until they stop, so parsed files may
+// be destroyed.
+void CancelParsing(std::vector<ParseTask>* parse_tasks) {
+  for (ParseTask& parse_task : *parse_tasks) {
+    if (parse_task.result.valid()) {
+      parse_task.progress->Cancel();
+    }
+  }
+  for (ParseTask& parse_task : *parse_tasks) {
+    if (parse_task.result.valid()) {
+      parse_task.result.wait();
+    }
+  }
+}
+
+// Starts following of |file|, if following was enabled for it.
+void WatchFile(oko::LogFilesFollower* follower, oko::LogFile* file) {
+  if (!follower || !file->is_followed()) {
+    return;
+  }
+  if (std::error_code ec = follower->Watch(file); ec) {
+    oko::MessageWindow::PostSync(boost::str(boost::format(
+        "Failed follow file %1%. %2%.") % file->file_path() % ec.message()));
+  }
+}
+
+void ShowCacheStats(const oko::CacheDirectoriesManager& cache_manager) {
+  const oko::CacheDirectoriesManager::Stats stats = cache_manager.GetStats();
+  oko::MessageWindow::PostSync(boost::str(boost::format(
+      "Cache hits: %1%, misses: %2%\n"
+      "Evicted directories: %3%, %4% MB\n"
+      "Cache size: about %5% MB of %6% MB") %
+      stats.hits_count %
+      stats.misses_count %
+      stats.evicted_directories_count %
+      (stats.evicted_bytes / kBytesInMegabyte) %
+      (stats.estimated_size / kBytesInMegabyte) %
+      (stats.max_size / kBytesInMegabyte)));
+}
+
+// Shows |files| while they are parsed by |parse_task|. If
+// |files_provider| is not nullptr, user may add more files from it.
+// If |follow| is true, records appended to files are shown too.
+// Returns false if parsing failed.
+bool ShowFiles(
+    std::vector<std::unique_ptr<oko::LogFile>> files,
+    ParseTask parse_task,
+    bool build_text_index,
+    bool follow,
+    oko::LogFilesProvider* files_provider,
+    const oko::CacheDirectoriesManager& cache_manager) {
+  std::vector<oko::LogFile*> followed_files;
+  for (const auto& f : files) {
+    followed_files.push_back(f.get());
+  }
+  oko::AppModel model(std::move(files), build_text_index);
+  std::vector<ParseTask> parse_tasks;
+  parse_tasks.emplace_back(std::move(parse_task));
+  // Declared after |model|, so files are not used by it when they are
+  // destroyed.
+  std::unique_ptr<oko::LogFilesFollower> follower;
+  if (follow) {
+    follower = std::make_unique<oko::LogFilesFollower>();
+    if (!follower->is_initialized()) {
+      oko::MessageWindow::PostSync("Failed initialize files following");
+      follower.reset();
+    }
+  }
+  for (oko::LogFile* f : followed_files) {
+    WatchFile(follower.get(), f);
+  }
   oko::ScreenLayout screen_layout(&model);
   ConfigureFunctionLabels(screen_layout.function_bar_window());
   std::unique_ptr<oko::DialogWindow> current_dialog;
 
   bool should_run = true;
   while (should_run) {
+    for (ParseTask& parse_task : parse_tasks) {
+      if (parse_task.result.valid() &&
+          parse_task.result.wait_for(std::chrono::seconds(0)) ==
+              std::future_status::ready) {
+        if (std::error_code parse_result = parse_task.result.get();
+            parse_result) {
+          oko::MessageWindow::PostSync(boost::str(boost::format(
+              "Failed parse file. %1%.") % parse_result.message()));
+          // Other files, e.g. added later, may be still parsed.
+          CancelParsing(&parse_tasks);
+          return false;
+        }
+      }
+    }
+    model.Update();
+    if (follower) {
+      for (const auto& [path, error] : follower->RetrieveStoppedFiles()) {
+        oko::MessageWindow::PostSync(boost::str(boost::format(
+            "Stopped following file %1%. %2%.") % path % error.message()));
+      }
+    }
+    // Wake up periodically to show newly parsed records and pick up
+    // text index and search results.
+    const bool has_background_work =
+        model.is_parsing() ||
+        model.is_following() ||
+        model.is_indexing() ||
+        model.is_searching() ||
+        model.is_finding_search_hits();
+    timeout(has_background_work ? kParsingRefreshIntervalMs : -1);
     screen_layout.Display();
     if (current_dialog) {
       current_dialog->Display();
     }
     int key = getch();
+    if (key == ERR) {
+      continue;
+    }
     if (current_dialog) {
       current_dialog->HandleKeyPress(key);
     } else {
@@ -141,71 +352,68 @@ void ShowFiles(std::vector<std::unique_ptr<oko::LogFile>> files) {
         case 'N':
           model.SearchPrevEntry();
           break;
-        default:
-          screen_layout.HandleKeyPress(key);
-      }
-    }
-    if (current_dialog && current_dialog->finished()) {
-      current_dialog.reset();
-    }
-  }
-}
-
-std::vector<std::unique_ptr<oko::LogFile>> RunChooseFile(
-    oko::LogFilesProvider& files_provider) noexcept {
-  int num_rows = 0, num_columns = 0;
-  getmaxyx(stdscr, num_rows, num_columns);
-  oko::LogFilesWindow window(
-      &files_provider,
-      0, 0, num_rows - oko::FunctionBarWindow::kRows, num_columns);
-  oko::FunctionBarWindow func_window(
-      num_rows - oko::FunctionBarWindow::kRows, 0, num_columns);
-  func_window.SetLabel(1, "Help");
-  func_window.SetLabel(7, "Search");
-  func_window.SetLabel(8, "SearchNext");
-  func_window.SetLabel(9, "SearchPrev");
-  func_window.SetLabel(10, "ToggleMark");
-  func_window.SetLabel(11, "Quit");
-  std::unique_ptr<oko::DialogWindow> current_dialog;
-
-  while (!window.finished()) {
-    window.Display();
-    func_window.Display();
-    if (current_dialog) {
-      current_dialog->Display();
-    }
-    int key = getch();
-    if (current_dialog) {
-      current_dialog->HandleKeyPress(key);
-    } else {
-      switch (key) {
-        case KEY_F(1):
-          oko::MessageWindow::PostSync(kFileChooserHelpMessage);
+        case '#':
+          current_dialog = std::make_unique<oko::GoToSearchHitDialog>(&model);
           break;
-        case 'q':
-        case KEY_F(11):
-          return {};
-        case '/':
-        case KEY_F(7):
-          current_dialog = std::make_unique<oko::SearchLogDialog>(&window);
+        case 'o':
+          if (!files_provider) {
+            oko::MessageWindow::PostSync(
+                "Files can be added only when viewing directory, "
+                "archive or S3 folder");
+            break;
+          }
+          {
+            oko::LogFilesLoader::Options loader_options;
+            loader_options.enable_following = follower != nullptr;
+            // Already shown files are not added again.
+            loader_options.skipped_paths = model.GetFilePaths();
+            ParseTask added_parse_task;
+            for (auto& file : RunChooseFile(
+                    *files_provider,
+                    std::move(loader_options),
+                    &added_parse_task)) {
+              oko::LogFile* added_file = file.get();
+              model.AddFile(std::move(file));
+              WatchFile(follower.get(), added_file);
+            }
+            if (added_parse_task.result.valid()) {
+              parse_tasks.emplace_back(std::move(added_parse_task));
+            }
+          }
           break;
-        case 'n':
-        case KEY_F(8):
-          window.SearchNextEntry();
+        case 'c':
+          ShowCacheStats(cache_manager);
           break;
-        case 'N':
-        case KEY_F(9):
-          window.SearchPrevEntry();
+        case 'x':
+          {
+            std::unique_ptr<oko::LogFile> removed_file =
+                model.RemoveFileOfSelectedRecord();
+            if (!removed_file) {
+              oko::MessageWindow::PostSync(
+                  "File can not be closed - it is the only one, "
+                  "or it is still parsed");
+            } else if (follower) {
+              follower->Unwatch(removed_file.get());
+            }
+          }
+          break;
+        case oko::kEscape:
+          if (model.is_searching()) {
+            model.CancelSearch();
+          } else {
+            screen_layout.HandleKeyPress(key);
+          }
           break;
         default:
-          window.HandleKeyPress(key);
+          screen_layout.HandleKeyPress(key);
       }
     }
     if (current_dialog && current_dialog->finished()) {
       current_dialog.reset();
     }
   }
-  return window.RetrieveFetchedFiles();
+  CancelParsing(&parse_tasks);
+  return true;
 }
 
 int main(int argc, char* argv[]) {
@@ -219,11 +427,29 @@ int main(int argc, char* argv[]) {
         ("directory,d", po::value<std::string>(),
             "Path to directory with log files")
         ("s3", po::value<std::string>(), "S3 folder URL")
+        ("s3_parallel_listing",
+            ("List sub-folders of S3 folder at once. Speeds up listing of "
+             "folders with many sub-folders."))
         ("zip,z", po::value<std::string>(), "Path to .zip file with logs")
         ("s3_debug_file",
             po::value<std::string>(),
             ("Path to file where "
-              "information about S3 communication will be stored.")),
+              "information about S3 communication will be stored."))
+        ("text_index",
+            ("Build text index after parsing, to speed up pattern filters "
+             "and search. Index of file in cache is stored in cache."))
+        ("follow,f",
+            ("Show records, appended to text log files while they are "
+             "viewed. Text index is not built in that mode."))
+        ("threads,j",
+            po::value<size_t>(),
+            ("Number of threads, used for fetching, parsing and filtering "
+             "of logs. By default equals to number of CPU cores."))
+        ("cache_size",
+            po::value<uint64_t>(),
+            ("Maximal size of cache in ~/.cache/oko, in megabytes. Least "
+             "recently used files are removed from cache, when it is "
+             "exceeded. 10240 by default."));
     po::store(
         po::command_line_parser(argc, argv).options(desc).run(),
         vm);
@@ -244,19 +470,46 @@ int main(int argc, char* argv[]) {
     vm.erase("s3_debug_file");
   }
 
+  const bool s3_parallel_listing = vm.count("s3_parallel_listing") != 0;
+  vm.erase("s3_parallel_listing");
+  const bool build_text_index = vm.count("text_index") != 0;
+  vm.erase("text_index");
+  const bool follow = vm.count("follow") != 0;
+  vm.erase("follow");
+  if (vm.count("threads") != 0) {
+    const size_t threads_count = vm["threads"].as<size_t>();
+    if (threads_count == 0) {
+      std::cerr << "Number of threads must be positive." << std::endl;
+      return 1;
+    }
+    oko::ThreadPool::SetThreadsCount(threads_count);
+    vm.erase("threads");
+  }
+  uint64_t max_cache_size = oko::CacheDirectoriesManager::kDefaultMaxSize;
+  if (vm.count("cache_size") != 0) {
+    max_cache_size = vm["cache_size"].as<uint64_t>() * kBytesInMegabyte;
+    vm.erase("cache_size");
+  }
+
   if (vm.size() != 1) {
     std::cerr << "Exactly one program option must be passed." << std::endl;
     return 1;
   }
 
   std::vector<std::unique_ptr<oko::LogFile>> files;
+  ParseTask parse_task;
+  // Kept during whole session, to allow adding more files.
+  std::unique_ptr<oko::LogFilesProvider> provider;
   oko::WithTUI tui_initializer;
   std::unique_ptr<oko::CacheDirectoriesManager> cache_manager =
-      std::make_unique<oko::CacheDirectoriesManager>();
+      std::make_unique<oko::CacheDirectoriesManager>(max_cache_size);
   if (!cache_manager->is_initialized()) {
     oko::MessageWindow::PostSync("Failed initialize cache");
     return 1;
   }
+  // Manager is owned by provider, if any.
+  const oko::CacheDirectoriesManager* const cache_manager_ptr =
+      cache_manager.get();
   if (vm.count("memorylog")) {
     files.emplace_back(std::make_unique<oko::MemorylogLogFile>(
         vm["memorylog"].as<std::string>()));
@@ -264,7 +517,6 @@ int main(int argc, char* argv[]) {
     files.emplace_back(std::make_unique<oko::TextLogFile>(
         vm["textlog"].as<std::string>()));
   } else if (vm.count("directory") || vm.count("s3") || vm.count("zip")) {
-    std::unique_ptr<oko::LogFilesProvider> provider;
     if (vm.count("directory")) {
       provider = std::make_unique<oko::DirectoryLogFilesProvider>(
           std::move(cache_manager),
@@ -291,9 +543,15 @@ int main(int argc, char* argv[]) {
       if (!s3_debug_file_path.empty()) {
         s3_provider->LogToFile(std::move(s3_debug_file_path));
       }
+      if (s3_parallel_listing) {
+        s3_provider->EnableParallelListing();
+      }
       provider = std::move(s3_provider);
     }
-    files = RunChooseFile(*provider);
+    oko::LogFilesLoader::Options loader_options;
+    loader_options.enable_following = follow;
+    files = RunChooseFile(
+        *provider, std::move(loader_options), &parse_task);
     if (files.empty()) {
       return 1;
     }
@@ -302,31 +560,43 @@ int main(int argc, char* argv[]) {
     assert(false);
     return 1;
   }
-  std::future<std::error_code> parse_async = std::async(
-      std::launch::async,
-      [&files] {
-        for (const auto& file : files) {
-          std::error_code ec = file->Parse();
-          if (ec) {
-            return ec;
-          }
-        }
-        return std::error_code();
-      });
+  if (!parse_task.result.valid()) {
+    // Single file, not loaded from provider.
+    if (follow) {
+      files[0]->EnableFollowing();
+    }
+    parse_task = StartParsing(files[0].get());
+  }
   {
+    // Wait until there are some records to show.
     oko::ProgressWindow parse_file_window(
         "Parsing files...",
-        [&parse_async] {
-            return parse_async.wait_for(
-                std::chrono::seconds(0)) == std::future_status::ready;
-        });
+        [&parse_task, &files] {
+            return parse_task.result.wait_for(
+                std::chrono::seconds(0)) == std::future_status::ready ||
+                std::any_of(
+                    files.begin(),
+                    files.end(),
+                    [](const std::unique_ptr<oko::LogFile>& f) {
+                      return f->UpdateRecords();
+                    });
+        },
+        parse_task.progress.get());
     parse_file_window.PostSync();
   }
-  if (std::error_code parse_result = parse_async.get(); parse_result) {
-    oko::MessageWindow::PostSync(boost::str(boost::format(
-        "Failed parse file. %1%.") % parse_result.message()));
+  if (parse_task.progress->is_cancelled()) {
+    // Files are not shown partially parsed.
+    parse_task.result.wait();
+    return 1;
+  }
+  if (!ShowFiles(
+          std::move(files),
+          std::move(parse_task),
+          build_text_index,
+          follow,
+          provider.get(),
+          *cache_manager_ptr)) {
     return 1;
   }
-  ShowFiles(std::move(files));
   return 0;
 }
@@ -5,73 +5,532 @@
 #include "viewer/merged_log_view.h"
 
 #include <algorithm>
-#include <functional>
-#include <numeric>
-#include <queue>
+#include <atomic>
+#include <cassert>
 #include <utility>
 
+#include "viewer/parallel_for.h"
+
 namespace oko {
 
 namespace {
 
-struct RecordListWithIt {
-  const std::vector<LogRecord>* container;
-  std::vector<LogRecord>::const_iterator next_pos;
+// Merges with less records are done by a single thread.
+constexpr size_t kMinMergePartitionSize = 64 * 1024;
+constexpr size_t kMergePartitionsPerThread = 4;
+// Number of timestamps, sampled from each input to choose splitters
+// between partitions.
+constexpr size_t kSamplesPerPartition = 16;
+
+// Records of one input, that are merged by some task.
+struct MergeRange {
+  size_t input;
+  size_t begin;
+  size_t end;
+};
+
+// Part of the merge, that does not depend on other parts.
+struct MergeTask {
+  // Ranges in order of increasing input index.
+  std::vector<MergeRange> ranges;
+  // Position of the first merged record in the result.
+  size_t first_record;
+};
+
+// Range of records of one input, being merged.
+struct MergeCursor {
+  const RecordStore* store;
+  // Store indexes of records of the range, or nullptr if the input is
+  // not filtered, so positions are the same as store indexes.
+  const uint32_t* store_indexes;
+  size_t pos;
+  size_t end;
+
+  size_t store_index() const noexcept {
+    return store_indexes ? store_indexes[pos] : pos;
+  }
+};
+
+// Tournament tree, where each internal node keeps the input that lost
+// comparison there. Choosing the next record requires only
+// log2(k) comparisons with losers on the path from the winner leaf to the
+// root, instead of ~2*log2(k) for binary heap. Ties are resolved in favour
+// of inputs with smaller index, so merge is stable.
+class LoserTree {
+ public:
+  explicit LoserTree(std::vector<MergeCursor>* cursors) noexcept
+      : cursors_(*cursors),
+        keys_(cursors_.size()),
+        nodes_(cursors_.size()) {
+    const size_t count = cursors_.size();
+    for (size_t i = 0; i < count; ++i) {
+      UpdateKey(i);
+    }
+    // Leaves are nodes [count, 2 * count), so each internal node
+    // has two children.
+    std::vector<size_t> winners(2 * count);
+    for (size_t i = 0; i < count; ++i) {
+      winners[count + i] = i;
+    }
+    for (size_t node = count - 1; node > 0; --node) {
+      const size_t left = winners[2 * node];
+      const size_t right = winners[2 * node + 1];
+      const bool left_wins = Less(left, right);
+      winners[node] = left_wins ? left : right;
+      nodes_[node] = left_wins ? right : left;
+    }
+    nodes_[0] = winners[1];
+  }
+
+  bool empty() const noexcept {
+    return exhausted(nodes_[0]);
+  }
+
+  // Input with the smallest next record.
+  size_t top() const noexcept {
+    return nodes_[0];
+  }
+
+  // Must be called after moving cursor of |top()|.
+  void ReplayTop() noexcept {
+    size_t winner = nodes_[0];
+    UpdateKey(winner);
+    for (size_t node = (cursors_.size() + winner) / 2; node > 0; node /= 2) {
+      if (Less(nodes_[node], winner)) {
+        std::swap(nodes_[node], winner);
+      }
+    }
+    nodes_[0] = winner;
+  }
 
-  explicit RecordListWithIt(const std::vector<LogRecord>* c) noexcept
-      : container(c),
-        next_pos(c->begin()) {
+ private:
+  bool exhausted(size_t input) const noexcept {
+    return cursors_[input].pos == cursors_[input].end;
   }
 
-  bool operator < (const RecordListWithIt& second) const noexcept {
-    return next_pos->timestamp() < second.next_pos->timestamp();
+  void UpdateKey(size_t input) noexcept {
+    const MergeCursor& cursor = cursors_[input];
+    keys_[input] = exhausted(input) ?
+        LogRecord::time_point::max() :
+        cursor.store->timestamp(cursor.store_index());
   }
 
-  bool operator > (const RecordListWithIt& second) const noexcept {
-    return next_pos->timestamp() > second.next_pos->timestamp();
+  bool Less(size_t first, size_t second) const noexcept {
+    // Exhausted inputs have the largest key, so they are checked only
+    // when keys are equal.
+    if (keys_[first] != keys_[second]) {
+      return keys_[first] < keys_[second];
+    }
+    if (exhausted(first) != exhausted(second)) {
+      return exhausted(second);
+    }
+    return first < second;
   }
+
+  const std::vector<MergeCursor>& cursors_;
+  std::vector<LogRecord::time_point> keys_;
+  // |nodes_[0]| - overall winner, other ones - losers of internal nodes.
+  std::vector<size_t> nodes_;
 };
 
+// Number of partitions for processing |count| records on several threads.
+size_t GetPartitionsCount(size_t count) noexcept {
+  return std::clamp<size_t>(
+      count / kMinMergePartitionSize,
+      1,
+      GetParallelism() * kMergePartitionsPerThread);
+}
+
+// Calls |func(p)| for each partition |p| in range [0, partitions_count)
+// on several threads.
+template<typename Func>
+void ForEachPartition(size_t partitions_count, const Func& func) noexcept {
+  std::atomic<size_t> next_partition = 0;
+  ParallelFor(
+      std::min(partitions_count, GetParallelism()),
+      [&](size_t) {
+        for (size_t p = next_partition++;
+             p < partitions_count;
+             p = next_partition++) {
+          func(p);
+        }
+      });
+}
+
+// Chooses |partitions_count - 1| timestamps, that split merged records
+// of |cluster| inputs into partitions of roughly equal size.
+std::vector<LogRecord::time_point> ChooseSplitters(
+    const std::vector<RecordsAccessor>& inputs,
+    const std::vector<size_t>& cluster,
+    size_t total_size,
+    size_t partitions_count) noexcept {
+  // Inputs are sampled proportionally to their sizes, so each sample
+  // represents roughly the same number of records.
+  const size_t samples_count = partitions_count * kSamplesPerPartition;
+  std::vector<LogRecord::time_point> samples;
+  samples.reserve(samples_count + cluster.size());
+  for (size_t input : cluster) {
+    const RecordsAccessor& records = inputs[input];
+    const size_t size = records.size();
+    const size_t input_samples = samples_count * size / total_size;
+    for (size_t i = 0; i < input_samples; ++i) {
+      samples.push_back(records.timestamp(
+          (2 * i + 1) * size / (2 * input_samples)));
+    }
+  }
+  std::sort(samples.begin(), samples.end());
+  std::vector<LogRecord::time_point> result;
+  result.reserve(partitions_count - 1);
+  for (size_t p = 1; p < partitions_count && !samples.empty(); ++p) {
+    result.push_back(samples[samples.size() * p / partitions_count]);
+  }
+  return result;
+}
+
+// Groups inputs into clusters with overlapping time ranges. Clusters are
+// returned in timestamp order, and all records of each cluster precede
+// records of the next one, so clusters may be merged independently.
+// Inputs inside cluster are ordered by index.
+std::vector<std::vector<size_t>> FindClusters(
+    const std::vector<RecordsAccessor>& inputs) noexcept {
+  std::vector<size_t> order(inputs.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(
+      order.begin(),
+      order.end(),
+      [&inputs](size_t first, size_t second) {
+        return inputs[first].timestamp(0) < inputs[second].timestamp(0);
+      });
+  std::vector<std::vector<size_t>> result;
+  LogRecord::time_point cluster_end;
+  for (size_t input : order) {
+    const RecordsAccessor& records = inputs[input];
+    // Inputs, that touch at the same timestamp, are merged, so records
+    // with equal timestamps keep order of inputs.
+    if (result.empty() || records.timestamp(0) > cluster_end) {
+      result.emplace_back();
+      cluster_end = records.timestamp(records.size() - 1);
+    } else {
+      cluster_end = std::max(
+          cluster_end, records.timestamp(records.size() - 1));
+    }
+    result.back().push_back(input);
+  }
+  for (std::vector<size_t>& cluster : result) {
+    std::sort(cluster.begin(), cluster.end());
+  }
+  return result;
+}
+
+// Splits merge of all records of |cluster| inputs into tasks, appending
+// them to |tasks|. Returns number of records in the cluster.
+size_t AddClusterTasks(
+    const std::vector<RecordsAccessor>& inputs,
+    const std::vector<size_t>& cluster,
+    size_t first_record,
+    std::vector<MergeTask>* tasks) noexcept {
+  size_t total_size = 0;
+  for (size_t input : cluster) {
+    total_size += inputs[input].size();
+  }
+  const size_t partitions_count = GetPartitionsCount(total_size);
+  if (cluster.size() == 1) {
+    // Records of the single input are just copied, in parallel by
+    // equal parts.
+    for (size_t p = 0; p < partitions_count; ++p) {
+      const size_t begin = total_size * p / partitions_count;
+      const size_t end = total_size * (p + 1) / partitions_count;
+      tasks->push_back(
+          MergeTask{{{cluster[0], begin, end}}, first_record + begin});
+    }
+    return total_size;
+  }
+  const std::vector<LogRecord::time_point> splitters = ChooseSplitters(
+      inputs, cluster, total_size, partitions_count);
+  // Records, equal to splitter, go to the next partition, so
+  // all records with the same timestamp are merged by one thread.
+  std::vector<size_t> range_begins(cluster.size(), 0);
+  for (size_t p = 0; p <= splitters.size(); ++p) {
+    MergeTask task{{}, first_record};
+    for (size_t i = 0; i < cluster.size(); ++i) {
+      const RecordsAccessor& records = inputs[cluster[i]];
+      const size_t end = p < splitters.size() ?
+          records.LowerBound(splitters[p]) : records.size();
+      if (end != range_begins[i]) {
+        task.ranges.push_back(MergeRange{cluster[i], range_begins[i], end});
+        first_record += end - range_begins[i];
+        range_begins[i] = end;
+      }
+    }
+    if (!task.ranges.empty()) {
+      tasks->push_back(std::move(task));
+    }
+  }
+  return total_size;
+}
+
+// Merges records of |task| into linked store |result|, which sources
+// are stores of |inputs|.
+void RunMergeTask(
+    const std::vector<RecordsAccessor>& inputs,
+    const MergeTask& task,
+    RecordStore* result) noexcept {
+  if (task.ranges.size() == 1) {
+    // Nothing to merge - just copy references to records.
+    const MergeRange& range = task.ranges[0];
+    inputs[range.input].ForEach(
+        range.begin,
+        range.end,
+        [&task, &range, result](size_t pos, size_t store_index) {
+          result->SetSourceRecord(
+              task.first_record + pos - range.begin, range.input, store_index);
+          return false;
+        });
+    return;
+  }
+  std::vector<MergeCursor> cursors;
+  cursors.reserve(task.ranges.size());
+  // Store indexes of filtered inputs are extracted at once, since random
+  // access to selection may be slow.
+  std::vector<std::vector<uint32_t>> store_indexes;
+  store_indexes.reserve(task.ranges.size());
+  for (const MergeRange& range : task.ranges) {
+    const RecordsAccessor& records = inputs[range.input];
+    MergeCursor cursor{&records.store(), nullptr, range.begin, range.end};
+    if (records.store().size() != records.size()) {
+      std::vector<uint32_t>& indexes = store_indexes.emplace_back();
+      indexes.reserve(range.end - range.begin);
+      records.ForEach(
+          range.begin, range.end, [&indexes](size_t, size_t store_index) {
+            indexes.push_back(static_cast<uint32_t>(store_index));
+            return false;
+          });
+      cursor.store_indexes = indexes.data();
+      cursor.pos = 0;
+      cursor.end = indexes.size();
+    }
+    cursors.push_back(cursor);
+  }
+  LoserTree tree(&cursors);
+  for (size_t index = task.first_record; !tree.empty(); ++index) {
+    const size_t top = tree.top();
+    MergeCursor& cursor = cursors[top];
+    result->SetSourceRecord(
+        index, task.ranges[top].input, cursor.store_index());
+    ++cursor.pos;
+    tree.ReplayTop();
+  }
+}
+
+// Returns index of the first record in range [begin, end) of |records|
+// with timestamp greater then |tp|, or |end| if there is no such record.
+size_t UpperBound(
+    const RecordsAccessor& records,
+    size_t begin,
+    size_t end,
+    LogRecord::time_point tp) noexcept {
+  size_t count = end - begin;
+  while (count > 0) {
+    const size_t step = count / 2;
+    const size_t middle = begin + step;
+    if (!(tp < records.timestamp(middle))) {
+      begin = middle + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return begin;
+}
+
 }  // namespace
 
 MergedLogView::MergedLogView(const std::vector<LogView*>& views) noexcept {
-  std::vector<RecordListWithIt> merged_lists;
-  merged_lists.reserve(views.size());
+  std::vector<RecordsAccessor> inputs;
+  inputs.reserve(views.size());
+  std::vector<const RecordStore*> sources;
+  sources.reserve(views.size());
   for (const LogView* v : views) {
-    const std::vector<LogRecord>& records = v->GetRecords();
+    const RecordsAccessor records = v->GetRecords();
     if (records.empty()) {
       continue;
     }
-    merged_lists.emplace_back(RecordListWithIt(&records));
+    inputs.push_back(records);
+    sources.push_back(&records.store());
   }
-  const size_t result_size = std::accumulate(
-      merged_lists.begin(),
-      merged_lists.end(),
-      static_cast<size_t>(0),
-      [](size_t l, const RecordListWithIt& r) {
-        return l + r.container->size();
-      });
-  records_.reserve(result_size);
-  // top - is the record list with smallest timestamp of the next record.
-  std::priority_queue<
-      RecordListWithIt,
-      std::vector<RecordListWithIt>,
-      std::greater<RecordListWithIt>> merged_queue(
-          std::greater<RecordListWithIt>(),
-          std::move(merged_lists));
-  while (!merged_queue.empty()) {
-    RecordListWithIt top = merged_queue.top();
-    merged_queue.pop();
-    records_.emplace_back(*top.next_pos);
-    ++top.next_pos;
-    if (top.next_pos != top.container->end()) {
-      merged_queue.emplace(std::move(top));
+  if (inputs.empty()) {
+    return;
+  }
+  records_ = RecordStore(std::move(sources));
+  // Inputs often do not overlap in time (e.g. rotated log files), so
+  // they are concatenated, and only overlapping ones are really merged.
+  std::vector<MergeTask> tasks;
+  size_t total_size = 0;
+  for (const std::vector<size_t>& cluster : FindClusters(inputs)) {
+    total_size += AddClusterTasks(inputs, cluster, total_size, &tasks);
+  }
+  records_.resize(total_size);
+  ForEachPartition(tasks.size(), [&](size_t t) {
+    RunMergeTask(inputs, tasks[t], &records_);
+  });
+  source_records_.resize(inputs.size());
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    source_records_[i].count = inputs[i].size();
+    source_records_[i].first_timestamp = inputs[i].timestamp(0);
+  }
+}
+
+void MergedLogView::AddRecords(
+    const LogView& added_view,
+    size_t added_begin,
+    std::vector<uint32_t>* added_positions) noexcept {
+  const RecordsAccessor added = added_view.GetRecords();
+  assert(added.size() == added.store().size());
+  assert(added_begin <= added.size());
+  added_positions->clear();
+  const size_t added_count = added.size() - added_begin;
+  if (added_count == 0) {
+    return;
+  }
+  size_t source_id = 0;
+  if (!records_.is_linked()) {
+    // All merged views were empty.
+    records_ = RecordStore(
+        std::vector<const RecordStore*>{&added.store()});
+  } else {
+    const std::vector<const RecordStore*>& sources = records_.sources();
+    // Added store remains merged, if only its tail was removed.
+    const auto it = std::find(sources.begin(), sources.end(), &added.store());
+    source_id = it != sources.end() ?
+        it - sources.begin() : records_.AddSource(&added.store());
+  }
+  if (source_id >= source_records_.size()) {
+    source_records_.resize(source_id + 1);
+  }
+  SourceRecords& source = source_records_[source_id];
+  assert(source.count == added_begin);
+  if (source.count == 0) {
+    source.first_timestamp = added.timestamp(added_begin);
+  }
+  const RecordsAccessor base(&records_);
+  const size_t base_size = base.size();
+  added_positions->resize(added_count);
+  if (base_size == 0 ||
+      !(added.timestamp(added_begin) < base.timestamp(base_size - 1))) {
+    // Records go after all merged ones, e.g. when they are appended to
+    // followed file.
+    for (size_t i = 0; i < added_count; ++i) {
+      (*added_positions)[i] = static_cast<uint32_t>(base_size + i);
+    }
+  } else {
+    // Find places of added records in parallel, each partition starts
+    // with binary search in all merged records.
+    const size_t added_partitions = GetPartitionsCount(added_count);
+    ForEachPartition(added_partitions, [&](size_t p) {
+      const size_t begin = added_count * p / added_partitions;
+      const size_t end = added_count * (p + 1) / added_partitions;
+      size_t base_pos = 0;
+      for (size_t i = begin; i < end; ++i) {
+        base_pos = UpperBound(
+            base, base_pos, base_size, added.timestamp(added_begin + i));
+        (*added_positions)[i] = static_cast<uint32_t>(base_pos + i);
+      }
+    });
+  }
+  std::vector<uint32_t> source_indexes(added_count);
+  for (size_t i = 0; i < added_count; ++i) {
+    source_indexes[i] = static_cast<uint32_t>(added_begin + i);
+  }
+  records_.InsertSourceRecords(*added_positions, source_id, source_indexes);
+  source.count += added_count;
+}
+
+void MergedLogView::RemoveRecords(
+    const RecordStore* removed_store,
+    size_t removed_begin,
+    std::vector<uint32_t>* removed_positions) noexcept {
+  removed_positions->clear();
+  if (!records_.is_linked()) {
+    return;
+  }
+  const std::vector<const RecordStore*>& sources = records_.sources();
+  const auto it = std::find(sources.begin(), sources.end(), removed_store);
+  // Removed store may be not found if it had no records during merge.
+  if (it == sources.end()) {
+    return;
+  }
+  const size_t source_id = it - sources.begin();
+  SourceRecords& source = source_records_[source_id];
+  if (removed_begin < source.count) {
+    const size_t removed_count = source.count - removed_begin;
+    removed_positions->reserve(removed_count);
+    if (removed_begin > 0) {
+      // Removed records are the last records of the source, usually
+      // appended recently, so they are searched from the end.
+      for (size_t index = records_.size();
+           removed_positions->size() < removed_count;
+           --index) {
+        assert(index > 0);
+        if (records_.source_id(index - 1) == source_id &&
+            records_.source_index(index - 1) >= removed_begin) {
+          removed_positions->push_back(static_cast<uint32_t>(index - 1));
+        }
+      }
+      std::reverse(removed_positions->begin(), removed_positions->end());
+    } else {
+      for (size_t index = LowerBoundForSource(
+               source_id, source.first_timestamp);
+           removed_positions->size() < removed_count;
+           ++index) {
+        assert(index < records_.size());
+        if (records_.source_id(index) == source_id) {
+          removed_positions->push_back(static_cast<uint32_t>(index));
+        }
+      }
+    }
+    records_.EraseRecords(*removed_positions);
+    source.count = removed_begin;
+  }
+  if (removed_begin == 0) {
+    records_.RemoveSource(source_id);
+    source = SourceRecords();
+  }
+}
+
+void MergedLogView::ReplaceRecords(
+    const LogView& view,
+    size_t begin,
+    StoreChange* change) noexcept {
+  RemoveRecords(&view.GetRecords().store(), begin, &change->removed);
+  AddRecords(view, begin, &change->added);
+  change->new_store_size = records_.size();
+}
+
+size_t MergedLogView::LowerBoundForSource(
+    size_t source_id,
+    LogRecord::time_point first_timestamp) const noexcept {
+  // Records of other sources with equal timestamp may go on both sides of
+  // the searched one, so result may precede it by such records.
+  size_t first = 0;
+  size_t count = records_.size();
+  while (count > 0) {
+    const size_t step = count / 2;
+    const size_t middle = first + step;
+    if (records_.source_id(middle) != source_id &&
+        records_.timestamp(middle) < first_timestamp) {
+      first = middle + 1;
+      count -= step + 1;
+    } else {
+      count = step;
     }
   }
+  return first;
 }
 
-const std::vector<LogRecord>& MergedLogView::GetRecords() const noexcept {
-  return records_;
+RecordsAccessor MergedLogView::GetRecords() const noexcept {
+  return RecordsAccessor(&records_);
 }
 
 }  // namespace oko
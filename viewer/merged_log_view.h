@@ -3,20 +3,76 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <cstdint>
 #include <vector>
+
 #include "viewer/log_view.h"
+#include "viewer/record_selection.h"
 
 namespace oko {
 
-// Merges records from several views, in timestamp order.
+// Merges records from several views, in timestamp order. Records are
+// not copied - view keeps only references to records of |views|, so
+// their records must not change during view lifetime.
 class MergedLogView : public LogView {
  public:
+  // Views must not be filtered, so records can be removed later by
+  // |RemoveRecords|.
   MergedLogView(const std::vector<LogView*>& views) noexcept;
+  // Adds records of not filtered |added_view|, starting from
+  // |added_begin|, which must be the number of its records, merged
+  // already. Records of |added_view| go after merged records with equal
+  // timestamps. Only places of added records are searched, and only
+  // records after the first added one are moved, so records, appended
+  // after all merged ones, are added in time proportional to their
+  // count. Sorted indexes of added records are stored to
+  // |added_positions|.
+  void AddRecords(
+      const LogView& added_view,
+      size_t added_begin,
+      std::vector<uint32_t>* added_positions) noexcept;
+  // Removes records of store |removed_store|, one of merged views,
+  // starting from |removed_begin|. If it is not zero store remains
+  // merged. Records of |removed_store| are not accessed, so they may be
+  // already changed. Tail of the store is found from the end of merged
+  // records, so only records after the first removed one are checked.
+  // Sorted indexes of removed records in view before the change are
+  // stored to |removed_positions|.
+  void RemoveRecords(
+      const RecordStore* removed_store,
+      size_t removed_begin,
+      std::vector<uint32_t>* removed_positions) noexcept;
+  // Replaces merged records of |view| store, starting from |begin|, with
+  // its current ones, e.g. after records were appended to followed file.
+  // When new records go after other merged ones, the change takes time
+  // proportional to number of merged records after the first replaced.
+  void ReplaceRecords(
+      const LogView& view,
+      size_t begin,
+      StoreChange* change) noexcept;
   // Returned log records must be ordered by their timestamp.
-  const std::vector<LogRecord>& GetRecords() const noexcept override;
+  RecordsAccessor GetRecords() const noexcept override;
 
  private:
-  std::vector<LogRecord> records_;
+  // Merged records of one source store. They are always its first
+  // records.
+  struct SourceRecords {
+    size_t count = 0;
+    // Timestamp of the first record, kept since the store may change
+    // before its records are removed.
+    LogRecord::time_point first_timestamp;
+  };
+
+  // Returns index of the first merged record, that may be the first
+  // record of source |source_id|, which has |first_timestamp|. Compares
+  // timestamps only with records of other sources, that stay unchanged.
+  size_t LowerBoundForSource(
+      size_t source_id,
+      LogRecord::time_point first_timestamp) const noexcept;
+
+  RecordStore records_;
+  // Indexed by source id of |records_|.
+  std::vector<SourceRecords> source_records_;
 };
 
 }  // namespace oko
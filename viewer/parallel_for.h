@@ -0,0 +1,33 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <functional>
+
+#include "viewer/thread_pool.h"
+
+namespace oko {
+
+// Returns number of tasks that may be effectively run simultaneously.
+inline size_t GetParallelism() noexcept {
+  return ThreadPool::instance().threads_count();
+}
+
+// Calls |func(i)| for each i in range [0, count), distributing calls
+// among threads of the pool. Blocks until all calls are finished.
+// |func| must be safe to call concurrently for different indexes.
+template<typename Func>
+void ParallelFor(size_t count, const Func& func) noexcept {
+  if (count == 0) {
+    return;
+  }
+  if (count == 1) {
+    func(0);
+    return;
+  }
+  ThreadPool::instance().ParallelFor(
+      count, std::function<void(size_t)>(std::cref(func)));
+}
+
+}  // namespace oko
@@ -0,0 +1,43 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/progress.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace oko {
+
+const char* Progress::StageName(Stage stage) noexcept {
+  switch (stage) {
+    case Stage::kFetching:
+      return "fetching";
+    case Stage::kHashing:
+      return "hashing";
+    case Stage::kDecompressing:
+      return "decompressing";
+    case Stage::kParsing:
+      return "parsing";
+    case Stage::kMerging:
+      return "merging";
+    case Stage::kFiltering:
+      return "filtering";
+  }
+  assert(false);
+  return "";
+}
+
+double Progress::GetDonePart(Stage stage) const noexcept {
+  // Bytes are preferred, since records count is usually unknown until
+  // data is parsed.
+  if (const uint64_t total = total_bytes(stage); total > 0) {
+    return std::min(1.0, static_cast<double>(done_bytes(stage)) / total);
+  }
+  if (const uint64_t total = total_records(stage); total > 0) {
+    return std::min(1.0, static_cast<double>(done_records(stage)) / total);
+  }
+  return -1;
+}
+
+}  // namespace oko
@@ -0,0 +1,174 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace oko {
+
+// Progress of long operation, e.g. loading of files or applying of filter.
+// Operation consists of stages, which may run at once, e.g. when files are
+// loaded in pipeline. Counters are updated by worker threads and read by UI
+// thread without locking. Amount of work may be measured in bytes, records
+// or both; zero total means it is unknown yet.
+// Operation may be cancelled through its progress. Stages check
+// |is_cancelled| periodically, and stop with |ErrorCodes::kCancelled|,
+// leaving no partially written files.
+class Progress {
+ public:
+  enum class Stage {
+    kFetching = 0,
+    kHashing,
+    kDecompressing,
+    kParsing,
+    kMerging,
+    kFiltering,
+  };
+  static constexpr size_t kStagesCount = 6;
+
+  static const char* StageName(Stage stage) noexcept;
+
+  void AddTotalBytes(Stage stage, uint64_t bytes) noexcept {
+    Add(&counters(stage).total_bytes, bytes);
+  }
+  void AddDoneBytes(Stage stage, uint64_t bytes) noexcept {
+    Add(&counters(stage).done_bytes, bytes);
+  }
+  void AddTotalRecords(Stage stage, uint64_t records_count) noexcept {
+    Add(&counters(stage).total_records, records_count);
+  }
+  // Records, that were processed or produced by |stage|.
+  void AddDoneRecords(Stage stage, uint64_t records_count) noexcept {
+    Add(&counters(stage).done_records, records_count);
+  }
+
+  uint64_t total_bytes(Stage stage) const noexcept {
+    return Get(counters(stage).total_bytes);
+  }
+  uint64_t done_bytes(Stage stage) const noexcept {
+    return Get(counters(stage).done_bytes);
+  }
+  uint64_t total_records(Stage stage) const noexcept {
+    return Get(counters(stage).total_records);
+  }
+  uint64_t done_records(Stage stage) const noexcept {
+    return Get(counters(stage).done_records);
+  }
+  // Number of tasks, that run |stage| now, see |ProgressStage|.
+  uint64_t running_tasks_count(Stage stage) const noexcept {
+    return Get(counters(stage).running_tasks_count);
+  }
+
+  // Returns true if stage is running or did some work.
+  bool is_started(Stage stage) const noexcept {
+    return running_tasks_count(stage) > 0 ||
+        total_bytes(stage) > 0 ||
+        total_records(stage) > 0 ||
+        done_records(stage) > 0;
+  }
+
+  // Returns part of work, that |stage| did, from 0 to 1, or negative
+  // value if total amount of work is unknown.
+  double GetDonePart(Stage stage) const noexcept;
+
+  // May be called from any thread.
+  void Cancel() noexcept {
+    cancelled_.store(true, std::memory_order_relaxed);
+  }
+
+  bool is_cancelled() const noexcept {
+    return cancelled_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  friend class ProgressStage;
+
+  struct Counters {
+    std::atomic<uint64_t> total_bytes = 0;
+    std::atomic<uint64_t> done_bytes = 0;
+    std::atomic<uint64_t> total_records = 0;
+    std::atomic<uint64_t> done_records = 0;
+    std::atomic<uint64_t> running_tasks_count = 0;
+  };
+
+  static void Add(std::atomic<uint64_t>* counter, uint64_t value) noexcept {
+    counter->fetch_add(value, std::memory_order_relaxed);
+  }
+
+  static uint64_t Get(const std::atomic<uint64_t>& counter) noexcept {
+    return counter.load(std::memory_order_relaxed);
+  }
+
+  Counters& counters(Stage stage) noexcept {
+    return counters_[static_cast<size_t>(stage)];
+  }
+
+  const Counters& counters(Stage stage) const noexcept {
+    return counters_[static_cast<size_t>(stage)];
+  }
+
+  Counters counters_[kStagesCount];
+  std::atomic<bool> cancelled_ = false;
+};
+
+// Marks |stage| of |progress| as running by current task during lifetime,
+// and reports work of the stage. |progress| may be nullptr, then nothing
+// is reported.
+class ProgressStage {
+ public:
+  ProgressStage(Progress* progress, Progress::Stage stage) noexcept
+      : progress_(progress),
+        stage_(stage) {
+    if (progress_) {
+      Progress::Add(&progress_->counters(stage_).running_tasks_count, 1);
+    }
+  }
+
+  ~ProgressStage() {
+    if (progress_) {
+      progress_->counters(stage_).running_tasks_count.fetch_sub(
+          1, std::memory_order_relaxed);
+    }
+  }
+
+  ProgressStage(const ProgressStage&) = delete;
+  ProgressStage& operator = (const ProgressStage&) = delete;
+
+  Progress* progress() const noexcept {
+    return progress_;
+  }
+
+  bool is_cancelled() const noexcept {
+    return progress_ && progress_->is_cancelled();
+  }
+
+  void AddTotalBytes(uint64_t bytes) noexcept {
+    if (progress_) {
+      progress_->AddTotalBytes(stage_, bytes);
+    }
+  }
+  void AddDoneBytes(uint64_t bytes) noexcept {
+    if (progress_) {
+      progress_->AddDoneBytes(stage_, bytes);
+    }
+  }
+  void AddTotalRecords(uint64_t records_count) noexcept {
+    if (progress_) {
+      progress_->AddTotalRecords(stage_, records_count);
+    }
+  }
+  void AddDoneRecords(uint64_t records_count) noexcept {
+    if (progress_) {
+      progress_->AddDoneRecords(stage_, records_count);
+    }
+  }
+
+ private:
+  Progress* const progress_;
+  const Progress::Stage stage_;
+};
+
+}  // namespace oko
@@ -0,0 +1,133 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/record_selection.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace oko {
+
+RecordSelection::Builder::Builder(size_t store_size) noexcept
+    : store_size_(store_size),
+      bits_((store_size + 63) / 64, 0) {
+  // Indexes must fit in 32 bits to be stored as array.
+  assert(store_size <= std::numeric_limits<uint32_t>::max());
+}
+
+RecordSelection RecordSelection::Builder::Finish() noexcept {
+  RecordSelection result;
+  result.size_ = count_;
+  if (count_ == 0) {
+    return result;
+  }
+  // Bitmap takes one bit per record of the store plus one 32-bit rank
+  // per block; array takes 32 bits per selected record.
+  const size_t bitmap_bits = store_size_ +
+      store_size_ / (kWordsPerBlock * 64) * 32;
+  if (bitmap_bits < count_ * 32) {
+    // Extra zero word allows iteration to read past the last set bit.
+    bits_.push_back(0);
+    result.block_ranks_.reserve(bits_.size() / kWordsPerBlock + 1);
+    uint32_t rank = 0;
+    for (size_t i = 0; i < bits_.size(); ++i) {
+      if (i % kWordsPerBlock == 0) {
+        result.block_ranks_.push_back(rank);
+      }
+      rank += __builtin_popcountll(bits_[i]);
+    }
+    result.bits_ = std::move(bits_);
+  } else {
+    result.indexes_.reserve(count_);
+    for (size_t i = 0; i < bits_.size(); ++i) {
+      uint64_t word = bits_[i];
+      while (word != 0) {
+        result.indexes_.push_back(
+            static_cast<uint32_t>(i * 64 + __builtin_ctzll(word)));
+        word &= word - 1;
+      }
+    }
+    bits_.clear();
+    bits_.shrink_to_fit();
+  }
+  return result;
+}
+
+size_t RecordSelection::Select(size_t position) const noexcept {
+  const auto block_it = std::upper_bound(
+      block_ranks_.begin(), block_ranks_.end(), position);
+  assert(block_it != block_ranks_.begin());
+  const size_t block = (block_it - block_ranks_.begin()) - 1;
+  size_t remaining = position - block_ranks_[block];
+  size_t word_index = block * kWordsPerBlock;
+  while (true) {
+    const size_t word_count = __builtin_popcountll(bits_[word_index]);
+    if (remaining < word_count) {
+      break;
+    }
+    remaining -= word_count;
+    ++word_index;
+  }
+  uint64_t word = bits_[word_index];
+  for (; remaining > 0; --remaining) {
+    word &= word - 1;
+  }
+  return word_index * 64 + __builtin_ctzll(word);
+}
+
+size_t RecordSelection::Rank(size_t store_index) const noexcept {
+  if (!is_bitmap()) {
+    return std::lower_bound(indexes_.begin(), indexes_.end(), store_index) -
+        indexes_.begin();
+  }
+  const size_t word_index = std::min(store_index / 64, bits_.size() - 1);
+  const size_t block = word_index / kWordsPerBlock;
+  size_t result = block_ranks_[block];
+  for (size_t i = block * kWordsPerBlock; i < word_index; ++i) {
+    result += __builtin_popcountll(bits_[i]);
+  }
+  if (store_index / 64 == word_index) {
+    result += __builtin_popcountll(
+        bits_[word_index] & ((uint64_t(1) << (store_index % 64)) - 1));
+  }
+  return result;
+}
+
+RecordSelection RecordSelection::ApplyChange(
+    const StoreChange& change,
+    const std::vector<uint32_t>& selected_added) const noexcept {
+  Builder builder(change.new_store_size);
+  size_t removed_before = 0;
+  size_t added_before = 0;
+  size_t next_selected_added = 0;
+  ForEach(0, size_, [&](size_t, size_t store_index) {
+    while (removed_before < change.removed.size() &&
+           change.removed[removed_before] < store_index) {
+      ++removed_before;
+    }
+    if (removed_before < change.removed.size() &&
+        change.removed[removed_before] == store_index) {
+      return false;
+    }
+    // Added records take places before the kept record, shifting it.
+    const size_t kept_index = store_index - removed_before;
+    while (added_before < change.added.size() &&
+           change.added[added_before] <= kept_index + added_before) {
+      ++added_before;
+    }
+    const size_t new_index = kept_index + added_before;
+    while (next_selected_added < selected_added.size() &&
+           selected_added[next_selected_added] < new_index) {
+      builder.Add(selected_added[next_selected_added++]);
+    }
+    builder.Add(new_index);
+    return false;
+  });
+  for (; next_selected_added < selected_added.size(); ++next_selected_added) {
+    builder.Add(selected_added[next_selected_added]);
+  }
+  return builder.Finish();
+}
+
+}  // namespace oko
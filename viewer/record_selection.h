@@ -0,0 +1,168 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace oko {
+
+// Change of records of some store, that keeps order of remaining records.
+struct StoreChange {
+  // Sorted indexes of removed records in the store before the change.
+  std::vector<uint32_t> removed;
+  // Sorted indexes of added records in the store after the change.
+  std::vector<uint32_t> added;
+  // Number of records in the store after the change.
+  size_t new_store_size = 0;
+};
+
+// Ordered subset of records of some RecordStore, identified by their
+// indexes in that store. Depending on selectivity, indexes are stored
+// either as array of 32-bit integers, or as bitmap with one bit per
+// record of the store.
+class RecordSelection {
+ public:
+  // Collects indexes of selected records. Indexes must be added in
+  // increasing order.
+  class Builder {
+   public:
+    // |store_size| - number of records in the store.
+    explicit Builder(size_t store_size) noexcept;
+
+    void Add(size_t store_index) noexcept {
+      assert(store_index < store_size_);
+      bits_[store_index / 64] |= uint64_t(1) << (store_index % 64);
+      ++count_;
+    }
+
+    // Chooses more compact representation for collected indexes.
+    RecordSelection Finish() noexcept;
+
+   private:
+    const size_t store_size_;
+    std::vector<uint64_t> bits_;
+    size_t count_ = 0;
+  };
+
+  RecordSelection() noexcept = default;
+  RecordSelection(RecordSelection&&) noexcept = default;
+  RecordSelection& operator = (RecordSelection&&) noexcept = default;
+
+  size_t size() const noexcept {
+    return size_;
+  }
+
+  bool is_bitmap() const noexcept {
+    return !bits_.empty();
+  }
+
+  // Returns store index of |position|-th selected record.
+  size_t operator[](size_t position) const noexcept {
+    assert(position < size_);
+    return is_bitmap() ? Select(position) : indexes_[position];
+  }
+
+  // Returns number of selected records with store index less then
+  // |store_index|.
+  size_t Rank(size_t store_index) const noexcept;
+
+  // Returns selection of records of the store, changed by |change|.
+  // It contains records of this selection, except removed ones, and
+  // |selected_added| records, which must be sorted subset of
+  // |change.added|.
+  RecordSelection ApplyChange(
+      const StoreChange& change,
+      const std::vector<uint32_t>& selected_added) const noexcept;
+
+  // Calls |func(position, store_index)| for selected records with
+  // positions in range [begin, end), in increasing order, until
+  // |func| returns true.
+  template<typename Func>
+  void ForEach(size_t begin, size_t end, const Func& func) const noexcept;
+
+  // Same as |ForEach|, but visits records in decreasing order.
+  template<typename Func>
+  void ForEachReversed(
+      size_t begin, size_t end, const Func& func) const noexcept;
+
+ private:
+  // Number of words, covered by each item of |block_ranks_|.
+  static constexpr size_t kWordsPerBlock = 8;
+
+  size_t Select(size_t position) const noexcept;
+
+  size_t size_ = 0;
+  std::vector<uint32_t> indexes_;
+  std::vector<uint64_t> bits_;
+  // Number of set bits before each block of |kWordsPerBlock| words.
+  std::vector<uint32_t> block_ranks_;
+};
+
+template<typename Func>
+void RecordSelection::ForEach(
+    size_t begin, size_t end, const Func& func) const noexcept {
+  if (begin >= end) {
+    return;
+  }
+  assert(end <= size_);
+  if (!is_bitmap()) {
+    for (size_t position = begin; position < end; ++position) {
+      if (func(position, static_cast<size_t>(indexes_[position]))) {
+        return;
+      }
+    }
+    return;
+  }
+  const size_t first_index = Select(begin);
+  size_t word_index = first_index / 64;
+  uint64_t word = bits_[word_index] & (~uint64_t(0) << (first_index % 64));
+  size_t position = begin;
+  while (true) {
+    while (word != 0) {
+      const size_t bit = __builtin_ctzll(word);
+      if (func(position, word_index * 64 + bit) || ++position == end) {
+        return;
+      }
+      word &= word - 1;
+    }
+    word = bits_[++word_index];
+  }
+}
+
+template<typename Func>
+void RecordSelection::ForEachReversed(
+    size_t begin, size_t end, const Func& func) const noexcept {
+  if (begin >= end) {
+    return;
+  }
+  assert(end <= size_);
+  if (!is_bitmap()) {
+    for (size_t position = end; position > begin; --position) {
+      if (func(position - 1, static_cast<size_t>(indexes_[position - 1]))) {
+        return;
+      }
+    }
+    return;
+  }
+  const size_t last_index = Select(end - 1);
+  size_t word_index = last_index / 64;
+  uint64_t word = bits_[word_index] &
+      (~uint64_t(0) >> (63 - last_index % 64));
+  size_t position = end;
+  while (true) {
+    while (word != 0) {
+      const size_t bit = 63 - __builtin_clzll(word);
+      if (func(position - 1, word_index * 64 + bit) || --position == begin) {
+        return;
+      }
+      word &= ~(uint64_t(1) << bit);
+    }
+    word = bits_[--word_index];
+  }
+}
+
+}  // namespace oko
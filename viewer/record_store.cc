@@ -0,0 +1,204 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/record_store.h"
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace oko {
+
+namespace {
+
+// Grows |values| by |positions.size()| elements, moving existing ones, so
+// new elements get sorted indexes |positions|. New element |i| is set to
+// |new_value(i)|.
+template<typename T, typename Func>
+void InsertValues(
+    const std::vector<uint32_t>& positions,
+    const Func& new_value,
+    std::vector<T>* values) noexcept {
+  size_t src = values->size();
+  size_t dst = src + positions.size();
+  values->resize(dst);
+  // Existing elements are moved from the end, so each one moves once.
+  for (size_t i = positions.size(); i > 0; --i) {
+    const size_t pos = positions[i - 1];
+    const size_t moved_count = dst - pos - 1;
+    std::move_backward(
+        values->begin() + src - moved_count,
+        values->begin() + src,
+        values->begin() + dst);
+    src -= moved_count;
+    dst = pos;
+    (*values)[pos] = new_value(i - 1);
+  }
+}
+
+// Removes elements with sorted indexes |positions| from |values|.
+template<typename T>
+void EraseValues(
+    const std::vector<uint32_t>& positions,
+    std::vector<T>* values) noexcept {
+  if (positions.empty()) {
+    return;
+  }
+  auto dst = values->begin() + positions[0];
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const size_t end = i + 1 < positions.size() ?
+        positions[i + 1] : values->size();
+    dst = std::move(
+        values->begin() + positions[i] + 1, values->begin() + end, dst);
+  }
+  values->resize(values->size() - positions.size());
+}
+
+}  // namespace
+
+RecordStore::RecordStore(std::string_view data) noexcept
+    : data_(data.data()) {
+}
+
+RecordStore::RecordStore(std::vector<const RecordStore*> sources) noexcept
+    : sources_(std::move(sources)) {
+  assert(!sources_.empty());
+  assert(sources_.size() <= std::numeric_limits<uint16_t>::max() + 1);
+}
+
+void RecordStore::Append(
+    LogRecord::time_point timestamp,
+    LogLevel log_level,
+    std::string_view message) noexcept {
+  assert(!is_linked());
+  assert(message.data() >= data_);
+  const size_t offset = message.data() - data_;
+  assert(offset < (uint64_t(1) << (64 - kLengthBits)));
+  size_t length = message.size();
+  if (length >= kLengthMask) {
+    long_message_lengths_[locations_.size()] = length;
+    length = kLengthMask;
+  }
+  timestamps_.push_back(timestamp);
+  levels_.push_back(log_level);
+  locations_.push_back((static_cast<uint64_t>(offset) << kLengthBits) |
+      length);
+}
+
+size_t RecordStore::AddSource(const RecordStore* source) noexcept {
+  assert(is_linked());
+  const auto free_it = std::find(sources_.begin(), sources_.end(), nullptr);
+  if (free_it != sources_.end()) {
+    *free_it = source;
+    return free_it - sources_.begin();
+  }
+  assert(sources_.size() <= std::numeric_limits<uint16_t>::max());
+  sources_.push_back(source);
+  if (sources_.size() == 2) {
+    // Records of single source had no ids.
+    source_ids_.assign(source_indexes_.size(), 0);
+  }
+  return sources_.size() - 1;
+}
+
+void RecordStore::RemoveSource(size_t source_id) noexcept {
+  assert(source_id < sources_.size());
+  sources_[source_id] = nullptr;
+}
+
+void RecordStore::InsertSourceRecords(
+    const std::vector<uint32_t>& positions,
+    size_t source_id,
+    const std::vector<uint32_t>& source_indexes) noexcept {
+  assert(is_linked());
+  assert(source_id < sources_.size());
+  assert(positions.size() == source_indexes.size());
+  if (sources_.size() > 1) {
+    InsertValues(
+        positions,
+        [source_id](size_t) {
+          return static_cast<uint16_t>(source_id);
+        },
+        &source_ids_);
+  }
+  InsertValues(
+      positions,
+      [&source_indexes](size_t i) {
+        return source_indexes[i];
+      },
+      &source_indexes_);
+}
+
+void RecordStore::EraseRecords(
+    const std::vector<uint32_t>& positions) noexcept {
+  assert(is_linked());
+  if (sources_.size() > 1) {
+    EraseValues(positions, &source_ids_);
+  }
+  EraseValues(positions, &source_indexes_);
+}
+
+void RecordStore::reserve(size_t records_count) noexcept {
+  if (is_linked()) {
+    if (sources_.size() > 1) {
+      source_ids_.reserve(records_count);
+    }
+    source_indexes_.reserve(records_count);
+    return;
+  }
+  timestamps_.reserve(records_count);
+  levels_.reserve(records_count);
+  locations_.reserve(records_count);
+}
+
+void RecordStore::resize(size_t records_count) noexcept {
+  if (!is_linked()) {
+    assert(records_count <= size());
+    timestamps_.resize(records_count);
+    levels_.resize(records_count);
+    locations_.resize(records_count);
+    for (auto it = long_message_lengths_.begin();
+         it != long_message_lengths_.end();) {
+      if (it->first >= records_count) {
+        it = long_message_lengths_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return;
+  }
+  if (sources_.size() > 1) {
+    source_ids_.resize(records_count);
+  }
+  source_indexes_.resize(records_count);
+}
+
+void RecordStore::clear() noexcept {
+  timestamps_.clear();
+  levels_.clear();
+  locations_.clear();
+  long_message_lengths_.clear();
+  source_ids_.clear();
+  source_indexes_.clear();
+}
+
+size_t RecordsAccessor::LowerBound(LogRecord::time_point tp) const noexcept {
+  size_t first = 0;
+  size_t count = size();
+  // Selected records preserve order of the store, so their timestamps
+  // are sorted too.
+  while (count > 0) {
+    const size_t step = count / 2;
+    const size_t middle = first + step;
+    if (timestamp(middle) < tp) {
+      first = middle + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+}  // namespace oko
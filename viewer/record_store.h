@@ -0,0 +1,262 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "viewer/log_record.h"
+#include "viewer/record_selection.h"
+
+namespace oko {
+
+// Columnar storage of log records. Timestamps, levels and message
+// locations are kept in separate contiguous arrays. Messages are not
+// copied - store keeps offset and length of each message inside the data
+// region (usually mapped log file).
+// Store may also be linked - instead of own records it keeps only
+// references to records of several source stores, e.g. to merge them
+// without copying.
+class RecordStore {
+ public:
+  RecordStore() noexcept = default;
+  // Creates store for records, which messages point into |data|.
+  explicit RecordStore(std::string_view data) noexcept;
+  // Creates linked store, which records refer to records of |sources|.
+  // Sources must outlive the store and must not change.
+  explicit RecordStore(std::vector<const RecordStore*> sources) noexcept;
+
+  RecordStore(RecordStore&&) noexcept = default;
+  RecordStore& operator = (RecordStore&&) noexcept = default;
+
+  // |message| must point into the data region of the store.
+  void Append(
+      LogRecord::time_point timestamp,
+      LogLevel log_level,
+      std::string_view message) noexcept;
+  void Append(const LogRecord& record) noexcept {
+    Append(record.timestamp(), record.log_level(), record.message());
+  }
+
+  // Makes record |index| of linked store refer to record |source_index|
+  // of |sources[source_id]|. Record must be allocated with |resize|.
+  // May be called concurrently for different |index| values.
+  void SetSourceRecord(
+      size_t index, size_t source_id, size_t source_index) noexcept {
+    assert(is_linked());
+    assert(source_id < sources_.size());
+    assert(source_index <= std::numeric_limits<uint32_t>::max());
+    if (!source_ids_.empty()) {
+      source_ids_[index] = static_cast<uint16_t>(source_id);
+    }
+    source_indexes_[index] = static_cast<uint32_t>(source_index);
+  }
+
+  // Adds |source| to sources of linked store, reusing slot of removed
+  // source, if any. Returns its source id.
+  size_t AddSource(const RecordStore* source) noexcept;
+  // Frees slot of source |source_id|. No records may refer to it.
+  void RemoveSource(size_t source_id) noexcept;
+  // Inserts records into linked store, so they get sorted indexes
+  // |positions| in it. Inserted record |i| refers to record
+  // |source_indexes[i]| of source |source_id|. Only records after the
+  // first inserted one are moved.
+  void InsertSourceRecords(
+      const std::vector<uint32_t>& positions,
+      size_t source_id,
+      const std::vector<uint32_t>& source_indexes) noexcept;
+  // Removes records with sorted indexes |positions| from linked store.
+  // Only records after the first removed one are moved.
+  void EraseRecords(const std::vector<uint32_t>& positions) noexcept;
+
+  void reserve(size_t records_count) noexcept;
+  // Not linked store can only shrink. Records of linked store, added by
+  // growing it, must be set with |SetSourceRecord|.
+  void resize(size_t records_count) noexcept;
+  void clear() noexcept;
+
+  size_t size() const noexcept {
+    return is_linked() ? source_indexes_.size() : timestamps_.size();
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  bool is_linked() const noexcept {
+    return !sources_.empty();
+  }
+
+  // Stores, that records of linked store refer to. Slots of removed
+  // sources are nullptr.
+  const std::vector<const RecordStore*>& sources() const noexcept {
+    return sources_;
+  }
+
+  // Index in |sources()| of the store, that contains record |index|
+  // of linked store.
+  size_t source_id(size_t index) const noexcept {
+    assert(is_linked());
+    return source_ids_.empty() ? 0 : source_ids_[index];
+  }
+
+  // Index of record |index| of linked store in its source store.
+  size_t source_index(size_t index) const noexcept {
+    assert(is_linked());
+    return source_indexes_[index];
+  }
+
+  LogRecord operator[](size_t index) const noexcept {
+    return LogRecord(timestamp(index), log_level(index), message(index));
+  }
+
+  LogRecord::time_point timestamp(size_t index) const noexcept {
+    if (is_linked()) {
+      return source(index).timestamp(source_indexes_[index]);
+    }
+    return timestamps_[index];
+  }
+
+  LogLevel log_level(size_t index) const noexcept {
+    if (is_linked()) {
+      return source(index).log_level(source_indexes_[index]);
+    }
+    return levels_[index];
+  }
+
+  std::string_view message(size_t index) const noexcept {
+    if (is_linked()) {
+      return source(index).message(source_indexes_[index]);
+    }
+    const uint64_t location = locations_[index];
+    size_t length = location & kLengthMask;
+    if (length == kLengthMask) {
+      length = long_message_lengths_.at(index);
+    }
+    return std::string_view(data_ + (location >> kLengthBits), length);
+  }
+
+ private:
+  // Message location is packed into 64 bit - 40 bits for offset inside
+  // data region and 24 bits for message length. Longer messages
+  // have all length bits set, and their actual length is stored separately.
+  static constexpr int kLengthBits = 24;
+  static constexpr uint64_t kLengthMask = (uint64_t(1) << kLengthBits) - 1;
+
+  const RecordStore& source(size_t index) const noexcept {
+    return *sources_[source_id(index)];
+  }
+
+  std::vector<LogRecord::time_point> timestamps_;
+  std::vector<LogLevel> levels_;
+  std::vector<uint64_t> locations_;
+  const char* data_ = nullptr;
+  std::unordered_map<size_t, size_t> long_message_lengths_;
+  // Used only by linked stores.
+  std::vector<const RecordStore*> sources_;
+  // Filled only if store has more then one source.
+  std::vector<uint16_t> source_ids_;
+  std::vector<uint32_t> source_indexes_;
+};
+
+// Random access to records of some LogView. Records are either all
+// records of |store|, or only ones, chosen by |selection|.
+class RecordsAccessor {
+ public:
+  explicit RecordsAccessor(
+      const RecordStore* store,
+      const RecordSelection* selection = nullptr) noexcept
+      : store_(store),
+        selection_(selection) {
+  }
+
+  size_t size() const noexcept {
+    return selection_ ? selection_->size() : store_->size();
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  LogRecord operator[](size_t index) const noexcept {
+    return (*store_)[store_index(index)];
+  }
+
+  LogRecord::time_point timestamp(size_t index) const noexcept {
+    return store_->timestamp(store_index(index));
+  }
+
+  LogLevel log_level(size_t index) const noexcept {
+    return store_->log_level(store_index(index));
+  }
+
+  std::string_view message(size_t index) const noexcept {
+    return store_->message(store_index(index));
+  }
+
+  // Returns index of record |index| in the underlying store.
+  size_t store_index(size_t index) const noexcept {
+    return selection_ ? (*selection_)[index] : index;
+  }
+
+  // Returns index of the first record with timestamp not less then |tp|,
+  // or |size()| if there is no such record.
+  size_t LowerBound(LogRecord::time_point tp) const noexcept;
+
+  // Returns index of the first record with index in the underlying store
+  // not less then |store_index|, or |size()| if there is no such record.
+  size_t LowerBoundByStoreIndex(size_t store_index) const noexcept {
+    if (selection_) {
+      return selection_->Rank(store_index);
+    }
+    return std::min(store_index, store_->size());
+  }
+
+  // Calls |func(index, store_index)| for records in range [begin, end)
+  // in increasing order, until |func| returns true. Much faster then
+  // random access for bitmap selections.
+  template<typename Func>
+  void ForEach(size_t begin, size_t end, const Func& func) const noexcept {
+    if (selection_) {
+      selection_->ForEach(begin, end, func);
+      return;
+    }
+    for (size_t index = begin; index < end; ++index) {
+      if (func(index, index)) {
+        return;
+      }
+    }
+  }
+
+  // Same as |ForEach|, but visits records in decreasing order.
+  template<typename Func>
+  void ForEachReversed(
+      size_t begin, size_t end, const Func& func) const noexcept {
+    if (selection_) {
+      selection_->ForEachReversed(begin, end, func);
+      return;
+    }
+    for (size_t index = end; index > begin; --index) {
+      if (func(index - 1, index - 1)) {
+        return;
+      }
+    }
+  }
+
+  const RecordStore& store() const noexcept {
+    return *store_;
+  }
+
+ private:
+  const RecordStore* store_;
+  // May be nullptr, if all records of |store_| are accessible.
+  const RecordSelection* selection_;
+};
+
+}  // namespace oko
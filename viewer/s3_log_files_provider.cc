@@ -7,15 +7,26 @@
 // Macro provided by curses.h.
 #pragma push_macro("OK")
 #undef OK
+#include <aws/core/auth/AWSAuthSigner.h>
+#include <aws/core/client/ClientConfiguration.h>
 #include <aws/core/utils/logging/AWSLogging.h>
 #include <aws/core/utils/logging/DefaultLogSystem.h>
 #include <aws/s3/model/GetObjectRequest.h>
-#include <aws/s3/model/ListObjectsRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/s3/model/ListObjectsV2Request.h>
 #pragma pop_macro("OK")
-#include <boost/iostreams/copy.hpp>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <charconv>
 #include <fstream>
+#include <functional>
+#include <iterator>
 #include <regex>
+#include <thread>
 #include <utility>
+#include <vector>
 
 #include "viewer/error_codes.h"
 
@@ -24,6 +35,42 @@ namespace oko {
 namespace {
 
 static const char kUrl[] = "^https?://([^\\.]+)\\.[^/]*/(.*)";
+// Downloading progress is reported after each block.
+const size_t kDownloadBufferSize = 256 * 1024;
+// Smaller files are downloaded by single request, since each request
+// waits for the first byte.
+const uint64_t kMultipartDownloadThreshold = 16 * 1024 * 1024;
+const uint64_t kDownloadPartSize = 8 * 1024 * 1024;
+// Ranges of one file, downloaded at once.
+const size_t kDownloadThreadsCount = 8;
+// Several files are downloaded at once by |LogFilesLoader|, each by
+// several ranges.
+const unsigned kMaxConnectionsCount = 64;
+// Sub-directories, listed at once in parallel listing mode.
+const size_t kListingThreadsCount = 16;
+// Listing of the directory, stored in its cache directory. Name can not
+// clash with cached log files, since it does not look like log file name.
+const char kListingFileName[] = ".listing";
+const char kListingHeader[] = "oko-s3-listing 1";
+// Failed range is requested again from the first byte, not written yet.
+const int kRangeAttemptsCount = 3;
+
+std::error_code PWriteAll(
+    int fd, const char* data, size_t size, uint64_t offset) noexcept {
+  while (size > 0) {
+    const ssize_t written = ::pwrite(fd, data, size, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return std::error_code(errno, std::generic_category());
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+  return std::error_code();
+}
 
 bool SplitUrl(
     std::string url,
@@ -40,6 +87,45 @@ bool SplitUrl(
   return true;
 }
 
+// Runs |run_task| for indexes from 0 to |tasks_count| on at most
+// |threads_count| threads, including the current one. Plain threads are
+// used, since S3 requests mostly wait for network. Once some task fails,
+// others are not started, and running tasks should stop when |failed|
+// is set. Returns error of the first failed task.
+std::error_code RunInThreads(
+    size_t tasks_count,
+    size_t threads_count,
+    const std::function<std::error_code(
+        size_t index, const std::atomic<bool>& failed)>& run_task) noexcept {
+  std::atomic<size_t> next_index = 0;
+  std::atomic<bool> failed = false;
+  std::mutex error_mutex;
+  std::error_code first_error;
+  auto run_tasks = [&] {
+    for (size_t index = next_index++;
+        index < tasks_count && !failed;
+        index = next_index++) {
+      const std::error_code ec = run_task(index, failed);
+      if (ec) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!failed) {
+          first_error = ec;
+          failed = true;
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < std::min(tasks_count, threads_count); ++i) {
+    threads.emplace_back(run_tasks);
+  }
+  run_tasks();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  return first_error;
+}
+
 }  // namespace
 
 S3LogFilesProvider::S3LogFilesProvider(
@@ -69,106 +155,437 @@ S3LogFilesProvider::~S3LogFilesProvider() {
 }
 
 void S3LogFilesProvider::EnsureInitialized() noexcept {
-  if (!s3_client_) {
+  std::call_once(s3_client_init_flag_, [this] {
     Aws::InitAPI(aws_options_);
-    s3_client_ = std::make_unique<Aws::S3::S3Client>();
+    Aws::Client::ClientConfiguration config;
+    config.maxConnections = kMaxConnectionsCount;
+    // Local S3-compatible servers, set by S3_ENDPOINT, usually do not
+    // serve buckets as subdomains.
+    s3_client_ = std::make_unique<Aws::S3::S3Client>(
+        config,
+        Aws::Client::AWSAuthV4Signer::PayloadSigningPolicy::Never,
+        endpoint_url_.empty());
     if (!endpoint_url_.empty()) {
       s3_client_->OverrideEndpoint(endpoint_url_.c_str());
     }
-  }
+  });
 }
 
 outcome::std_result<std::vector<LogFileInfo>>
     S3LogFilesProvider::GetLogFileInfos() noexcept {
+  std::vector<LogFileInfo> result;
+  const std::error_code ec = ListLogFiles(
+      [&result](std::vector<LogFileInfo> file_infos) {
+        std::move(
+            file_infos.begin(), file_infos.end(), std::back_inserter(result));
+      },
+      nullptr);
+  if (ec) {
+    return ec;
+  }
+  return result;
+}
+
+std::error_code S3LogFilesProvider::ListLogFiles(
+    const FileInfosCallback& on_file_infos,
+    const Progress* progress) noexcept {
   if (bucket_name_.empty()) {
     return ErrorCodes::kFailedDownloadFile;
   }
+  EnsureInitialized();
+  std::vector<ListedFile> stored_files = ReadListing();
+  std::mutex new_files_mutex;
+  std::vector<ListedFile> new_files;
+  const ListedFilesCallback on_listed_files =
+      [&on_file_infos, &new_files_mutex, &new_files](
+          std::vector<ListedFile> listed_files) {
+        std::vector<LogFileInfo> file_infos;
+        file_infos.reserve(listed_files.size());
+        for (const ListedFile& listed_file : listed_files) {
+          file_infos.push_back(listed_file.info);
+        }
+        std::lock_guard<std::mutex> lock(new_files_mutex);
+        std::move(
+            listed_files.begin(),
+            listed_files.end(),
+            std::back_inserter(new_files));
+        on_file_infos(std::move(file_infos));
+      };
+  std::error_code ec;
+  if (stored_files.empty()) {
+    ec = ListDirectory(on_listed_files, progress);
+  } else {
+    std::vector<LogFileInfo> file_infos;
+    file_infos.reserve(stored_files.size());
+    for (const ListedFile& stored_file : stored_files) {
+      file_infos.push_back(stored_file.info);
+    }
+    on_file_infos(std::move(file_infos));
+    // Keys are listed in lexicographical order, so new objects follow
+    // the last stored one.
+    ec = ListPrefix(
+        s3_directory_name_,
+        std::string(),
+        s3_directory_name_ + stored_files.back().info.name,
+        on_listed_files,
+        progress,
+        nullptr);
+  }
+  if (ec) {
+    return ec;
+  }
+  if (!new_files.empty()) {
+    std::move(
+        new_files.begin(), new_files.end(), std::back_inserter(stored_files));
+    std::sort(
+        stored_files.begin(),
+        stored_files.end(),
+        [](const ListedFile& first, const ListedFile& second) {
+          return first.info.name < second.info.name;
+        });
+    // Failure only makes next listing slower.
+    WriteListing(stored_files);
+  }
+  return std::error_code();
+}
 
-  Aws::S3::Model::ListObjectsRequest objects_request;
-  objects_request.SetBucket(bucket_name_.c_str());
-  objects_request.SetPrefix(s3_directory_name_.c_str());
+std::error_code S3LogFilesProvider::ListDirectory(
+    const ListedFilesCallback& on_listed_files,
+    const Progress* progress) noexcept {
+  if (!parallel_listing_) {
+    return ListPrefix(
+        s3_directory_name_,
+        std::string(),
+        std::string(),
+        on_listed_files,
+        progress,
+        nullptr);
+  }
+  std::vector<std::string> sub_prefixes;
+  if (const std::error_code ec = ListPrefix(
+          s3_directory_name_,
+          "/",
+          std::string(),
+          on_listed_files,
+          progress,
+          &sub_prefixes)) {
+    return ec;
+  }
+  return RunInThreads(
+      sub_prefixes.size(),
+      kListingThreadsCount,
+      [&](size_t index, const std::atomic<bool>&) {
+        return ListPrefix(
+            sub_prefixes[index],
+            std::string(),
+            std::string(),
+            on_listed_files,
+            progress,
+            nullptr);
+      });
+}
 
-  EnsureInitialized();
-  auto list_objects_result = s3_client_->ListObjects(objects_request);
+std::error_code S3LogFilesProvider::ListPrefix(
+    const std::string& prefix,
+    const std::string& delimiter,
+    const std::string& start_after,
+    const ListedFilesCallback& on_listed_files,
+    const Progress* progress,
+    std::vector<std::string>* common_prefixes) noexcept {
+  Aws::S3::Model::ListObjectsV2Request objects_request;
+  objects_request.SetBucket(bucket_name_.c_str());
+  objects_request.SetPrefix(prefix.c_str());
+  if (!delimiter.empty()) {
+    objects_request.SetDelimiter(delimiter.c_str());
+  }
+  if (!start_after.empty()) {
+    objects_request.SetStartAfter(start_after.c_str());
+  }
+  for (;;) {
+    if (progress && progress->is_cancelled()) {
+      return ErrorCodes::kCancelled;
+    }
+    auto list_objects_result = s3_client_->ListObjectsV2(objects_request);
+    if (!list_objects_result.IsSuccess()) {
+      // TODO(vchigrin): provide detailed error description.
+      return ErrorCodes::kFailedDownloadFile;
+    }
+    const Aws::S3::Model::ListObjectsV2Result& page =
+        list_objects_result.GetResult();
+    std::vector<ListedFile> listed_files;
+    for (const Aws::S3::Model::Object& s3_obj : page.GetContents()) {
+      std::optional<LogFileInfo> file_info = KeyToFileInfo(
+          s3_obj.GetKey().c_str(), static_cast<uint64_t>(s3_obj.GetSize()));
+      if (file_info) {
+        listed_files.emplace_back(ListedFile{
+            std::move(*file_info),
+            s3_obj.GetETag().c_str()});
+      }
+    }
+    if (common_prefixes) {
+      for (const Aws::S3::Model::CommonPrefix& common_prefix :
+          page.GetCommonPrefixes()) {
+        common_prefixes->emplace_back(common_prefix.GetPrefix().c_str());
+      }
+    }
+    if (!listed_files.empty()) {
+      on_listed_files(std::move(listed_files));
+    }
+    if (!page.GetIsTruncated() || page.GetNextContinuationToken().empty()) {
+      break;
+    }
+    objects_request.SetContinuationToken(page.GetNextContinuationToken());
+  }
+  return std::error_code();
+}
 
-  if (!list_objects_result.IsSuccess()) {
-    // TODO(vchigrin): provide detailed error description.
-    return ErrorCodes::kFailedDownloadFile;
+std::optional<LogFileInfo> S3LogFilesProvider::KeyToFileInfo(
+    const std::string& key, uint64_t size) const noexcept {
+  const size_t directory_name_len = s3_directory_name_.length();
+  if (key.size() <= directory_name_len) {
+    assert(false);  // S3 API does not respect Prefix in our request?
+    return std::nullopt;
+  }
+  std::string file_path = key.substr(directory_name_len);
+  auto idx = file_path.rfind('/');
+  std::string file_name;
+  if (idx != std::string::npos) {
+    file_name = file_path.substr(idx + 1);
+  } else {
+    file_name = file_path;
+  }
+  if (!CanBeLogFileName(file_name)) {
+    return std::nullopt;
   }
-  Aws::Vector<Aws::S3::Model::Object> objects =
-      list_objects_result.GetResult().GetContents();
+  return LogFileInfo{std::move(file_path), size};
+}
 
-  std::vector<LogFileInfo> result;
-  result.reserve(objects.size());
-  const size_t directoryn_name_len = s3_directory_name_.length();
-  for (const Aws::S3::Model::Object& s3_obj : objects) {
-    const auto& key = s3_obj.GetKey();
-    if (key.size() <= directoryn_name_len) {
-      assert(false);  // S3 API does not respect Prefix in our request?
-      continue;
+std::vector<S3LogFilesProvider::ListedFile>
+    S3LogFilesProvider::ReadListing() const noexcept {
+  std::ifstream src_file(cache_directory_path_ / kListingFileName);
+  std::string line;
+  if (!std::getline(src_file, line) || line != kListingHeader) {
+    return {};
+  }
+  std::vector<ListedFile> result;
+  while (std::getline(src_file, line)) {
+    // Line is "<size>\t<etag>\t<name>".
+    const size_t etag_pos = line.find('\t');
+    const size_t name_pos = etag_pos == std::string::npos ?
+        std::string::npos : line.find('\t', etag_pos + 1);
+    if (name_pos == std::string::npos) {
+      return {};
     }
-    std::string file_path(
-        key.data() + directoryn_name_len,
-        key.size() - directoryn_name_len);
-    auto idx = file_path.rfind('/');
-    std::string file_name;
-    if (idx != std::string::npos) {
-      file_name = file_path.substr(idx + 1);
-    } else {
-      file_name = file_path;
-    }
-    if (CanBeLogFileName(file_name)) {
-      result.emplace_back(LogFileInfo{
-          std::move(file_path),
-          static_cast<uint64_t>(s3_obj.GetSize())
-      });
+    uint64_t size = 0;
+    const auto res = std::from_chars(
+        line.data(), line.data() + etag_pos, size);
+    if (res.ec != std::errc() || res.ptr != line.data() + etag_pos) {
+      return {};
     }
+    result.emplace_back(ListedFile{
+        LogFileInfo{line.substr(name_pos + 1), size},
+        line.substr(etag_pos + 1, name_pos - etag_pos - 1)});
+  }
+  if (!src_file.eof() ||
+      !std::is_sorted(
+          result.begin(),
+          result.end(),
+          [](const ListedFile& first, const ListedFile& second) {
+            return first.info.name < second.info.name;
+          })) {
+    return {};
   }
   return result;
 }
 
-outcome::std_result<std::unique_ptr<LogFile>>
-S3LogFilesProvider::FetchLog(const std::string& log_file_name) noexcept {
-  std::filesystem::path dst_path = cache_directory_path_ / log_file_name;
+std::error_code S3LogFilesProvider::WriteListing(
+    const std::vector<ListedFile>& listed_files) const noexcept {
+  const std::filesystem::path listing_path =
+      cache_directory_path_ / kListingFileName;
+  std::filesystem::path tmp_file_path = listing_path;
+  // Other processes may write listing of the same directory at once.
+  tmp_file_path.concat(".tmp" + std::to_string(getpid()));
+  {
+    std::ofstream dst_file(
+        tmp_file_path,
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!dst_file.is_open()) {
+      return std::error_code(errno, std::generic_category());
+    }
+    dst_file << kListingHeader << '\n';
+    for (const ListedFile& listed_file : listed_files) {
+      // Line breaks would corrupt the format. They are not expected in
+      // names of log files.
+      if (listed_file.info.name.find('\n') != std::string::npos) {
+        continue;
+      }
+      dst_file << listed_file.info.size << '\t' <<
+          listed_file.etag << '\t' << listed_file.info.name << '\n';
+    }
+    if (!dst_file) {
+      std::error_code ec;
+      std::filesystem::remove(tmp_file_path, ec);
+      return ErrorCodes::kFailedWriteFile;
+    }
+  }
   std::error_code ec;
-  if (std::filesystem::exists(dst_path, ec) && !ec) {
-    return CreateFileForPath(dst_path);
+  std::filesystem::rename(tmp_file_path, listing_path, ec);
+  return ec;
+}
+
+outcome::std_result<std::filesystem::path>
+S3LogFilesProvider::FetchLog(
+    const std::string& log_file_name, Progress* progress) noexcept {
+  std::filesystem::path dst_path = cache_directory_path_ / log_file_name;
+  ProgressStage fetching(progress, Progress::Stage::kFetching);
+  outcome::std_result<bool> maybe_downloaded =
+      cache_manager_->GetOrCreateFile(
+          dst_path,
+          progress,
+          [this, &log_file_name, &fetching](
+              const std::filesystem::path& tmp_file_path) {
+            return DownloadFile(log_file_name, tmp_file_path, &fetching);
+          });
+  if (!maybe_downloaded) {
+    return maybe_downloaded.error();
+  }
+  if (!maybe_downloaded.value()) {
+    std::error_code ec;
+    const uint64_t file_size = std::filesystem::file_size(dst_path, ec);
+    if (!ec) {
+      fetching.AddDoneBytes(file_size);
+    }
+  }
+  return dst_path;
+}
+
+std::error_code S3LogFilesProvider::DownloadFile(
+    const std::string& log_file_name,
+    const std::filesystem::path& dst_file_path,
+    ProgressStage* fetching) noexcept {
+  if (fetching->is_cancelled()) {
+    return ErrorCodes::kCancelled;
   }
-  Aws::S3::Model::GetObjectRequest object_request;
-  object_request.SetBucket(bucket_name_.c_str());
-  std::string key = s3_directory_name_ + log_file_name;
-  object_request.SetKey(key.c_str());
+  const std::string key = s3_directory_name_ + log_file_name;
+  Aws::S3::Model::HeadObjectRequest head_request;
+  head_request.SetBucket(bucket_name_.c_str());
+  head_request.SetKey(key.c_str());
   EnsureInitialized();
-  auto outcome = s3_client_->GetObject(object_request);
-  if (!outcome.IsSuccess()) {
+  auto head_outcome = s3_client_->HeadObject(head_request);
+  if (!head_outcome.IsSuccess()) {
     // TODO(vchigrin): provide detailed error description.
     return ErrorCodes::kFailedDownloadFile;
   }
-  Aws::S3::Model::GetObjectResult result = outcome.GetResultWithOwnership();
-  std::iostream& retrieved_file = result.GetBody();
-  std::filesystem::create_directories(dst_path.parent_path(), ec);
+  const uint64_t file_size = head_outcome.GetResult().GetContentLength();
+  const std::string etag = head_outcome.GetResult().GetETag();
+
+  const int fd = ::open(
+      dst_file_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return std::error_code(errno, std::generic_category());
+  }
+  std::error_code ec = DownloadParts(key, etag, fd, file_size, fetching);
+  if (::close(fd) != 0 && !ec) {
+    ec = std::error_code(errno, std::generic_category());
+  }
   if (ec) {
     return ec;
   }
-  std::filesystem::path tmp_file_path = dst_path;
-  tmp_file_path.concat(".tmp");
-  {
-    std::ofstream dst_file(
-        tmp_file_path,
-        std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!dst_file.is_open()) {
+  std::error_code size_ec;
+  if (std::filesystem::file_size(dst_file_path, size_ec) != file_size ||
+      size_ec) {
+    return ErrorCodes::kFailedDownloadFile;
+  }
+  return std::error_code();
+}
+
+std::error_code S3LogFilesProvider::DownloadParts(
+    const std::string& key,
+    const std::string& etag,
+    int fd,
+    uint64_t file_size,
+    ProgressStage* fetching) noexcept {
+  if (file_size > 0) {
+    // Ranges are written at their offsets, so file gets its final size
+    // at once. Not all file systems support preallocation.
+    const int err = ::posix_fallocate(fd, 0, file_size);
+    if (err != 0 && ::ftruncate(fd, file_size) != 0) {
       return std::error_code(errno, std::generic_category());
     }
-    size_t copied_size = boost::iostreams::copy(
-         retrieved_file,
-         dst_file);
-    if (copied_size != result.GetContentLength()) {
-      // Not all data copied.
+  }
+  if (file_size < kMultipartDownloadThreshold) {
+    const std::atomic<bool> failed = false;
+    return DownloadRange(key, etag, fd, 0, file_size, fetching, failed);
+  }
+  const uint64_t parts_count =
+      (file_size + kDownloadPartSize - 1) / kDownloadPartSize;
+  return RunInThreads(
+      parts_count,
+      kDownloadThreadsCount,
+      [&](size_t part, const std::atomic<bool>& failed) {
+        const uint64_t begin = part * kDownloadPartSize;
+        const uint64_t end = std::min(file_size, begin + kDownloadPartSize);
+        return DownloadRange(key, etag, fd, begin, end, fetching, failed);
+      });
+}
+
+std::error_code S3LogFilesProvider::DownloadRange(
+    const std::string& key,
+    const std::string& etag,
+    int fd,
+    uint64_t begin,
+    uint64_t end,
+    ProgressStage* fetching,
+    const std::atomic<bool>& failed) noexcept {
+  std::vector<char> buf(kDownloadBufferSize);
+  uint64_t offset = begin;
+  for (int attempt = 0;
+      attempt < kRangeAttemptsCount && offset < end;
+      ++attempt) {
+    if (fetching->is_cancelled()) {
+      return ErrorCodes::kCancelled;
+    }
+    if (failed) {
       return ErrorCodes::kFailedDownloadFile;
     }
+    Aws::S3::Model::GetObjectRequest object_request;
+    object_request.SetBucket(bucket_name_.c_str());
+    object_request.SetKey(key.c_str());
+    object_request.SetRange(
+        ("bytes=" + std::to_string(offset) + "-" +
+         std::to_string(end - 1)).c_str());
+    // Parts of different object versions should not be mixed, if object
+    // is overwritten during download.
+    if (!etag.empty()) {
+      object_request.SetIfMatch(etag.c_str());
+    }
+    auto outcome = s3_client_->GetObject(object_request);
+    if (!outcome.IsSuccess()) {
+      continue;
+    }
+    Aws::S3::Model::GetObjectResult result = outcome.GetResultWithOwnership();
+    std::iostream& retrieved_file = result.GetBody();
+    while (retrieved_file && offset < end &&
+        !fetching->is_cancelled() && !failed) {
+      retrieved_file.read(
+          buf.data(), std::min<uint64_t>(buf.size(), end - offset));
+      const size_t read_size = retrieved_file.gcount();
+      if (const std::error_code ec =
+              PWriteAll(fd, buf.data(), read_size, offset)) {
+        return ec;
+      }
+      offset += read_size;
+      fetching->AddDoneBytes(read_size);
+    }
+  }
+  if (fetching->is_cancelled()) {
+    return ErrorCodes::kCancelled;
+  }
+  if (offset != end) {
+    // Not all data copied.
+    return ErrorCodes::kFailedDownloadFile;
   }
-  std::filesystem::rename(tmp_file_path, dst_path);
-  return CreateFileForPath(dst_path);
+  return std::error_code();
 }
 
 void S3LogFilesProvider::LogToFile(
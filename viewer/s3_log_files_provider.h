@@ -9,7 +9,11 @@
 #include <aws/core/Aws.h>
 #include <aws/s3/S3Client.h>
 #pragma pop_macro("OK")
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -29,21 +33,95 @@ class S3LogFilesProvider : public LogFilesProvider {
   ~S3LogFilesProvider();
   outcome::std_result<std::vector<LogFileInfo>>
       GetLogFileInfos() noexcept override;
+  // Lists objects page by page. In parallel mode sub-directories of
+  // the directory are listed at once. Listing is stored in cache
+  // directory, assuming that objects are only added to the bucket. Stored
+  // files are passed first, then only objects with greater keys are
+  // listed.
+  std::error_code ListLogFiles(
+      const FileInfosCallback& on_file_infos,
+      const Progress* progress) noexcept override;
 
-  outcome::std_result<std::unique_ptr<LogFile>> FetchLog(
-      const std::string& log_file_name) noexcept override;
+  outcome::std_result<std::filesystem::path> FetchLog(
+      const std::string& log_file_name,
+      Progress* progress) noexcept override;
 
   void LogToFile(std::filesystem::path log_file_path) noexcept;
 
+  // Speeds up listing of directories with many sub-directories, at cost
+  // of more requests.
+  void EnableParallelListing() noexcept {
+    parallel_listing_ = true;
+  }
+
  private:
+  struct ListedFile {
+    LogFileInfo info;
+    std::string etag;
+  };
+  using ListedFilesCallback =
+      std::function<void(std::vector<ListedFile> listed_files)>;
+
   void EnsureInitialized() noexcept;
+  // Lists the whole directory, as requested by |parallel_listing_|.
+  std::error_code ListDirectory(
+      const ListedFilesCallback& on_listed_files,
+      const Progress* progress) noexcept;
+  // Lists objects with keys, starting with |prefix| and greater than
+  // |start_after|, if it is not empty. Passes log files to
+  // |on_listed_files| after each page. If |delimiter| is not empty,
+  // keys, containing it after |prefix|, are not listed, and their
+  // prefixes up to |delimiter| are added to |common_prefixes|.
+  std::error_code ListPrefix(
+      const std::string& prefix,
+      const std::string& delimiter,
+      const std::string& start_after,
+      const ListedFilesCallback& on_listed_files,
+      const Progress* progress,
+      std::vector<std::string>* common_prefixes) noexcept;
+  // Returns file info for object |key|, if it can be log file.
+  std::optional<LogFileInfo> KeyToFileInfo(
+      const std::string& key, uint64_t size) const noexcept;
+  // Returns files, stored by |WriteListing|, sorted by name. Returns
+  // empty list if listing was not stored or is corrupted.
+  std::vector<ListedFile> ReadListing() const noexcept;
+  std::error_code WriteListing(
+      const std::vector<ListedFile>& listed_files) const noexcept;
+  // Downloads file to |dst_file_path|, reporting it to |fetching|.
+  // Large files are downloaded by several ranges at once.
+  std::error_code DownloadFile(
+      const std::string& log_file_name,
+      const std::filesystem::path& dst_file_path,
+      ProgressStage* fetching) noexcept;
+  // Preallocates |fd| and fills it with |file_size| bytes of object
+  // |key|.
+  std::error_code DownloadParts(
+      const std::string& key,
+      const std::string& etag,
+      int fd,
+      uint64_t file_size,
+      ProgressStage* fetching) noexcept;
+  // Writes bytes [|begin|, |end|) of object |key| to |fd| at the same
+  // offsets. Object must still have |etag|. Stops when |failed| is set
+  // by download of another range.
+  std::error_code DownloadRange(
+      const std::string& key,
+      const std::string& etag,
+      int fd,
+      uint64_t begin,
+      uint64_t end,
+      ProgressStage* fetching,
+      const std::atomic<bool>& failed) noexcept;
   const std::filesystem::path cache_directory_path_;
   std::string bucket_name_;
   std::string s3_directory_name_;
   std::string endpoint_url_;
   Aws::SDKOptions aws_options_;
+  // Client is created once, and may be used by several threads.
+  std::once_flag s3_client_init_flag_;
   std::unique_ptr<Aws::S3::S3Client> s3_client_;
   bool logging_initialized_ = false;
+  bool parallel_listing_ = false;
 };
 
 }  // namespace oko
@@ -0,0 +1,119 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include "viewer/parallel_for.h"
+#include "viewer/progress.h"
+#include "viewer/record_store.h"
+
+namespace oko {
+
+// Minimal number of records, checked by one thread in |SelectRecords|.
+constexpr size_t kMinSelectPartitionSize = 64 * 1024;
+constexpr size_t kSelectPartitionsPerThread = 4;
+
+// Selects records of |records| for which |predicate(store_index)|
+// returns true. Records are checked on several threads, so |predicate|
+// must be safe to call concurrently. If |cancelled| is not nullptr and
+// becomes true, or |progress| is cancelled, stops early and returns
+// incomplete selection. Checked records are reported to |progress|, if
+// it is not nullptr.
+template<typename Predicate>
+RecordSelection SelectRecords(
+    const RecordsAccessor& records,
+    const Predicate& predicate,
+    const std::atomic<bool>* cancelled,
+    Progress* progress) noexcept {
+  const size_t count = records.size();
+  ProgressStage filtering(progress, Progress::Stage::kFiltering);
+  filtering.AddTotalRecords(count);
+  const size_t partitions_count = std::clamp<size_t>(
+      count / kMinSelectPartitionSize,
+      1,
+      GetParallelism() * kSelectPartitionsPerThread);
+  std::vector<std::vector<uint32_t>> partition_results(partitions_count);
+  std::atomic<size_t> next_partition = 0;
+  ParallelFor(
+      std::min(partitions_count, GetParallelism()),
+      [&](size_t) {
+        for (size_t p = next_partition++;
+             p < partitions_count &&
+                 !(cancelled && *cancelled) &&
+                 !filtering.is_cancelled();
+             p = next_partition++) {
+          std::vector<uint32_t>& result = partition_results[p];
+          const size_t begin = count * p / partitions_count;
+          const size_t end = count * (p + 1) / partitions_count;
+          records.ForEach(
+              begin,
+              end,
+              [&predicate, &result](size_t, size_t store_index) {
+                if (predicate(store_index)) {
+                  result.push_back(static_cast<uint32_t>(store_index));
+                }
+                return false;
+              });
+          filtering.AddDoneRecords(end - begin);
+        }
+      });
+  RecordSelection::Builder builder(records.store().size());
+  for (std::vector<uint32_t>& result : partition_results) {
+    for (uint32_t store_index : result) {
+      builder.Add(store_index);
+    }
+    result = std::vector<uint32_t>();
+  }
+  return builder.Finish();
+}
+
+// Returns sorted indexes of records from |added|, which belong to
+// |records| and for which |predicate(store_index)| returns true.
+// |added| - sorted indexes of records of |records.store()|. Records are
+// checked on several threads, so |predicate| must be safe to call
+// concurrently.
+template<typename Predicate>
+std::vector<uint32_t> SelectAddedRecords(
+    const RecordsAccessor& records,
+    const std::vector<uint32_t>& added,
+    const Predicate& predicate) noexcept {
+  const size_t count = added.size();
+  const size_t partitions_count = std::clamp<size_t>(
+      count / kMinSelectPartitionSize,
+      1,
+      GetParallelism() * kSelectPartitionsPerThread);
+  std::vector<std::vector<uint32_t>> partition_results(partitions_count);
+  std::atomic<size_t> next_partition = 0;
+  ParallelFor(
+      std::min(partitions_count, GetParallelism()),
+      [&](size_t) {
+        for (size_t p = next_partition++;
+             p < partitions_count;
+             p = next_partition++) {
+          std::vector<uint32_t>& result = partition_results[p];
+          for (size_t i = count * p / partitions_count;
+               i < count * (p + 1) / partitions_count;
+               ++i) {
+            const size_t store_index = added[i];
+            const size_t pos = records.LowerBoundByStoreIndex(store_index);
+            if (pos < records.size() &&
+                records.store_index(pos) == store_index &&
+                predicate(store_index)) {
+              result.push_back(static_cast<uint32_t>(store_index));
+            }
+          }
+        }
+      });
+  std::vector<uint32_t> result;
+  for (const std::vector<uint32_t>& partition_result : partition_results) {
+    result.insert(
+        result.end(), partition_result.begin(), partition_result.end());
+  }
+  return result;
+}
+
+}  // namespace oko
@@ -0,0 +1,168 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/substring_matcher.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace oko {
+
+namespace {
+
+size_t FindGeneric(std::string_view text, std::string_view pattern) noexcept {
+  return text.find(pattern);
+}
+
+size_t FindByte(std::string_view text, std::string_view pattern) noexcept {
+  if (text.empty()) {
+    return std::string_view::npos;
+  }
+  const void* result = std::memchr(text.data(), pattern[0], text.size());
+  if (!result) {
+    return std::string_view::npos;
+  }
+  return static_cast<const char*>(result) - text.data();
+}
+
+#if defined(__x86_64__)
+
+// Searches |pattern| in |text| starting from |pos|.
+size_t FindTail(
+    std::string_view text, std::string_view pattern, size_t pos) noexcept {
+  const size_t result = text.substr(pos).find(pattern);
+  return result == std::string_view::npos ?
+      std::string_view::npos : pos + result;
+}
+
+// Checks candidate positions, marked by set bits of |mask|, relative to
+// |pos|. Candidates have matching first and last bytes.
+size_t CheckCandidates(
+    std::string_view text,
+    std::string_view pattern,
+    size_t pos,
+    uint32_t mask) noexcept {
+  while (mask != 0) {
+    const size_t candidate = pos + __builtin_ctz(mask);
+    if (std::memcmp(
+            text.data() + candidate + 1,
+            pattern.data() + 1,
+            pattern.size() - 2) == 0) {
+      return candidate;
+    }
+    mask &= mask - 1;
+  }
+  return std::string_view::npos;
+}
+
+// Searches patterns of at least 2 bytes, checking 16 positions at once.
+size_t FindSse2(std::string_view text, std::string_view pattern) noexcept {
+  const size_t last_offset = pattern.size() - 1;
+  const __m128i first = _mm_set1_epi8(pattern.front());
+  const __m128i last = _mm_set1_epi8(pattern.back());
+  size_t pos = 0;
+  for (; pos + last_offset + sizeof(__m128i) <= text.size();
+       pos += sizeof(__m128i)) {
+    const __m128i block_first = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(text.data() + pos));
+    const __m128i block_last = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(text.data() + pos + last_offset));
+    const uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, block_first),
+        _mm_cmpeq_epi8(last, block_last)));
+    const size_t result = CheckCandidates(text, pattern, pos, mask);
+    if (result != std::string_view::npos) {
+      return result;
+    }
+  }
+  if (pos + last_offset >= text.size()) {
+    return std::string_view::npos;
+  }
+  if (text.size() < last_offset + sizeof(__m128i)) {
+    return FindTail(text, pattern, pos);
+  }
+  // Check remaining positions with the last block, that overlaps with
+  // already checked ones.
+  const size_t last_block = text.size() - last_offset - sizeof(__m128i);
+  const __m128i block_first = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(text.data() + last_block));
+  const __m128i block_last = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(text.data() + last_block + last_offset));
+  const uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+      _mm_cmpeq_epi8(first, block_first),
+      _mm_cmpeq_epi8(last, block_last)));
+  return CheckCandidates(
+      text, pattern, last_block, mask & (~0u << (pos - last_block)));
+}
+
+// Same as |FindSse2|, but checks 32 positions at once.
+__attribute__((target("avx2")))
+size_t FindAvx2(std::string_view text, std::string_view pattern) noexcept {
+  const size_t last_offset = pattern.size() - 1;
+  const __m256i first = _mm256_set1_epi8(pattern.front());
+  const __m256i last = _mm256_set1_epi8(pattern.back());
+  size_t pos = 0;
+  for (; pos + last_offset + sizeof(__m256i) <= text.size();
+       pos += sizeof(__m256i)) {
+    const __m256i block_first = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(text.data() + pos));
+    const __m256i block_last = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i*>(text.data() + pos + last_offset));
+    const uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(first, block_first),
+        _mm256_cmpeq_epi8(last, block_last)));
+    const size_t result = CheckCandidates(text, pattern, pos, mask);
+    if (result != std::string_view::npos) {
+      return result;
+    }
+  }
+  if (pos + last_offset >= text.size()) {
+    return std::string_view::npos;
+  }
+  if (text.size() < last_offset + sizeof(__m256i)) {
+    // Text is too short - check it with narrower vectors.
+    return FindSse2(text, pattern);
+  }
+  const size_t last_block = text.size() - last_offset - sizeof(__m256i);
+  const __m256i block_first = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(text.data() + last_block));
+  const __m256i block_last = _mm256_loadu_si256(
+      reinterpret_cast<const __m256i*>(text.data() + last_block + last_offset));
+  const uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+      _mm256_cmpeq_epi8(first, block_first),
+      _mm256_cmpeq_epi8(last, block_last)));
+  return CheckCandidates(
+      text, pattern, last_block, mask & (~0u << (pos - last_block)));
+}
+
+bool CpuSupportsAvx2() noexcept {
+  static const bool result = __builtin_cpu_supports("avx2");
+  return result;
+}
+
+#endif
+
+}  // namespace
+
+SubstringMatcher::SubstringMatcher(std::string pattern) noexcept
+    : pattern_(std::move(pattern)) {
+  if (pattern_.empty()) {
+    find_function_ = &FindGeneric;
+  } else if (pattern_.size() == 1) {
+    find_function_ = &FindByte;
+  } else {
+#if defined(__x86_64__)
+    find_function_ = CpuSupportsAvx2() ? &FindAvx2 : &FindSse2;
+#else
+    find_function_ = &FindGeneric;
+#endif
+  }
+}
+
+}  // namespace oko
@@ -0,0 +1,44 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <string>
+#include <string_view>
+
+namespace oko {
+
+// Searches for occurrences of the fixed pattern. Uses SIMD instructions
+// to find candidate positions, where both first and last bytes of
+// the pattern match, so only few positions are compared entirely.
+// Best implementation for the current CPU is chosen once, on construction.
+class SubstringMatcher {
+ public:
+  SubstringMatcher() noexcept
+      : SubstringMatcher(std::string()) {
+  }
+  explicit SubstringMatcher(std::string pattern) noexcept;
+
+  // Returns position of the first occurrence of pattern in |text|,
+  // or |std::string_view::npos| if there is no such occurrence.
+  size_t Find(std::string_view text) const noexcept {
+    return find_function_(text, pattern_);
+  }
+
+  bool Matches(std::string_view text) const noexcept {
+    return Find(text) != std::string_view::npos;
+  }
+
+  const std::string& pattern() const noexcept {
+    return pattern_;
+  }
+
+ private:
+  using FindFunction = size_t (*)(
+      std::string_view text, std::string_view pattern) noexcept;
+
+  std::string pattern_;
+  FindFunction find_function_;
+};
+
+}  // namespace oko
@@ -0,0 +1,261 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/thread_pool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+namespace oko {
+
+namespace {
+
+std::atomic<size_t> g_threads_count = 0;
+
+// Pool and index of worker, running on current thread.
+thread_local ThreadPool* t_pool = nullptr;
+thread_local size_t t_worker_index = 0;
+thread_local TaskPriority t_priority = TaskPriority::kInteractive;
+
+int64_t NowNs() noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Items of one |ParallelFor| call. Shared with helper tasks, which may
+// start after all items are finished.
+struct ParallelForJob {
+  const std::function<void(size_t)>* func;
+  size_t count;
+  TaskPriority priority;
+  std::atomic<size_t> next_item = 0;
+  std::atomic<size_t> finished_items = 0;
+  std::mutex mutex;
+  std::condition_variable finished_cv;
+
+  // Returns false if all items are already taken.
+  bool RunItem() noexcept {
+    const size_t item = next_item++;
+    if (item >= count) {
+      return false;
+    }
+    (*func)(item);
+    if (++finished_items == count) {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished_cv.notify_all();
+    }
+    return true;
+  }
+};
+
+// Runs single item and posts itself again, so workers may take tasks
+// with higher priority between items.
+void PostHelper(
+    ThreadPool* pool, std::shared_ptr<ParallelForJob> job) noexcept {
+  const TaskPriority priority = job->priority;
+  pool->Post(priority, [pool, job = std::move(job)]() mutable {
+    if (job->RunItem()) {
+      PostHelper(pool, std::move(job));
+    }
+  });
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(size_t threads_count) noexcept {
+  workers_.reserve(threads_count);
+  for (size_t i = 0; i < threads_count; ++i) {
+    workers_.emplace_back(std::make_unique<Worker>());
+  }
+  last_stats_ns_ = NowNs();
+  for (size_t i = 0; i < threads_count; ++i) {
+    workers_[i]->thread = std::thread([this, i] {
+      Run(i);
+    });
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    stopping_ = true;
+  }
+  wake_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker->thread.join();
+  }
+}
+
+// static
+void ThreadPool::SetThreadsCount(size_t threads_count) noexcept {
+  g_threads_count = threads_count;
+}
+
+// static
+ThreadPool& ThreadPool::instance() noexcept {
+  static ThreadPool pool(
+      g_threads_count > 0 ?
+          g_threads_count.load() :
+          std::max(1u, std::thread::hardware_concurrency()));
+  return pool;
+}
+
+// static
+TaskPriority ThreadPool::current_priority() noexcept {
+  return t_priority;
+}
+
+void ThreadPool::Post(
+    TaskPriority priority, std::function<void()> task) noexcept {
+  const size_t queue_index = static_cast<size_t>(priority);
+  // Counted before posting, so count never goes below zero.
+  {
+    std::lock_guard<std::mutex> lock(wake_mutex_);
+    ++queued_tasks_count_;
+  }
+  if (t_pool == this) {
+    Worker& worker = *workers_[t_worker_index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[queue_index].emplace_back(std::move(task));
+  } else {
+    std::lock_guard<std::mutex> lock(shared_mutex_);
+    shared_queues_[queue_index].emplace_back(std::move(task));
+  }
+  wake_cv_.notify_one();
+}
+
+void ThreadPool::ParallelFor(
+    size_t count, const std::function<void(size_t)>& func) noexcept {
+  auto job = std::make_shared<ParallelForJob>();
+  job->func = &func;
+  job->count = count;
+  job->priority = current_priority();
+  const size_t helpers_count = std::min(count, workers_.size() + 1) - 1;
+  for (size_t i = 0; i < helpers_count; ++i) {
+    PostHelper(this, job);
+  }
+  // Current thread would wait anyway, so it runs items too. Other
+  // tasks are not run here, since they may take long, while the caller
+  // may be waited by user, e.g. after cancellation.
+  while (job->RunItem()) {
+  }
+  std::unique_lock<std::mutex> lock(job->mutex);
+  job->finished_cv.wait(lock, [&job] {
+    return job->finished_items == job->count;
+  });
+}
+
+ThreadPool::Stats ThreadPool::GetStats() noexcept {
+  Stats result = {};
+  result.threads_count = workers_.size();
+  result.queued_tasks_count = queued_tasks_count_;
+  const int64_t now = NowNs();
+  int64_t busy_ns = 0;
+  for (const auto& worker : workers_) {
+    busy_ns += worker->busy_ns;
+    const int64_t task_start_ns = worker->task_start_ns;
+    if (task_start_ns != 0) {
+      ++result.busy_threads_count;
+      busy_ns += now - task_start_ns;
+    }
+  }
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  const int64_t elapsed_ns = now - last_stats_ns_;
+  if (elapsed_ns > 0 && !workers_.empty()) {
+    result.utilization = std::clamp(
+        static_cast<double>(busy_ns - last_stats_busy_ns_) /
+            (elapsed_ns * workers_.size()),
+        0.0,
+        1.0);
+  }
+  last_stats_ns_ = now;
+  last_stats_busy_ns_ = busy_ns;
+  return result;
+}
+
+void ThreadPool::Run(size_t worker_index) noexcept {
+  t_pool = this;
+  t_worker_index = worker_index;
+  std::function<void()> task;
+  TaskPriority priority;
+  while (true) {
+    if (TakeTask(TaskPriority::kBackground, &task, &priority)) {
+      RunTask(task, priority);
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    if (queued_tasks_count_ > 0) {
+      // Task is being posted now.
+      lock.unlock();
+      std::this_thread::yield();
+      continue;
+    }
+    if (stopping_) {
+      return;
+    }
+    wake_cv_.wait(lock, [this] {
+      return stopping_ || queued_tasks_count_ > 0;
+    });
+  }
+}
+
+bool ThreadPool::TakeTask(
+    TaskPriority lowest_priority,
+    std::function<void()>* task,
+    TaskPriority* priority) noexcept {
+  const auto take = [&](std::mutex& mutex, auto& queue, bool from_back) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (queue.empty()) {
+      return false;
+    }
+    if (from_back) {
+      *task = std::move(queue.back());
+      queue.pop_back();
+    } else {
+      *task = std::move(queue.front());
+      queue.pop_front();
+    }
+    --queued_tasks_count_;
+    return true;
+  };
+  const bool is_worker = (t_pool == this);
+  for (size_t p = 0; p <= static_cast<size_t>(lowest_priority); ++p) {
+    *priority = static_cast<TaskPriority>(p);
+    // Own tasks are taken in reverse order, since their data is likely
+    // in cache, and other tasks in order of posting.
+    if (is_worker) {
+      Worker& worker = *workers_[t_worker_index];
+      if (take(worker.mutex, worker.queues[p], true)) {
+        return true;
+      }
+    }
+    if (take(shared_mutex_, shared_queues_[p], false)) {
+      return true;
+    }
+    const size_t first_victim = is_worker ? t_worker_index + 1 : 0;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      Worker& victim = *workers_[(first_victim + i) % workers_.size()];
+      if (take(victim.mutex, victim.queues[p], false)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void ThreadPool::RunTask(
+    const std::function<void()>& task, TaskPriority priority) noexcept {
+  Worker& worker = *workers_[t_worker_index];
+  t_priority = priority;
+  const int64_t start_ns = NowNs();
+  worker.task_start_ns = start_ns;
+  task();
+  worker.busy_ns += NowNs() - start_ns;
+  worker.task_start_ns = 0;
+  t_priority = TaskPriority::kInteractive;
+}
+
+}  // namespace oko
@@ -0,0 +1,120 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace oko {
+
+// Tasks with higher priority are taken first. Interactive ones are
+// waited by user, background ones may take long and are not urgent.
+enum class TaskPriority {
+  kInteractive = 0,
+  kNormal,
+  kBackground,
+};
+
+// Process-wide pool of worker threads, that runs all background work.
+// Each worker has own queues of tasks, one per priority. Tasks, posted by
+// worker, go to its own queues, and other tasks go to shared queues. Idle
+// worker takes task with the highest priority from own queue, then from
+// shared one, then steals it from other workers. Running tasks are not
+// interrupted, but |ParallelFor| helpers run one item per task, so
+// workers take waiting tasks with higher priority between its items.
+class ThreadPool {
+ public:
+  struct Stats {
+    size_t threads_count;
+    size_t busy_threads_count;
+    size_t queued_tasks_count;
+    // Part of workers time, spent running tasks since previous call,
+    // from 0 to 1.
+    double utilization;
+  };
+
+  explicit ThreadPool(size_t threads_count) noexcept;
+  ~ThreadPool();
+
+  // Sets size of process-wide pool. Must be called before the first
+  // |instance| call. Zero means number of CPU cores.
+  static void SetThreadsCount(size_t threads_count) noexcept;
+  static ThreadPool& instance() noexcept;
+
+  // Priority of task, that runs on current thread. Threads outside of
+  // pools are used by user, so their work is interactive.
+  static TaskPriority current_priority() noexcept;
+
+  size_t threads_count() const noexcept {
+    return workers_.size();
+  }
+
+  void Post(TaskPriority priority, std::function<void()> task) noexcept;
+
+  template<typename Func>
+  auto Submit(TaskPriority priority, Func func) noexcept {
+    using Result = decltype(func());
+    auto task = std::make_shared<std::packaged_task<Result()>>(
+        std::move(func));
+    std::future<Result> result = task->get_future();
+    Post(priority, [task] {
+      (*task)();
+    });
+    return result;
+  }
+
+  // Calls |func(i)| for each i in range [0, count) on current thread
+  // and pool workers, with priority of current task. Blocks until all
+  // calls are finished.
+  void ParallelFor(
+      size_t count, const std::function<void(size_t)>& func) noexcept;
+
+  Stats GetStats() noexcept;
+
+ private:
+  static constexpr size_t kPrioritiesCount = 3;
+  using TaskQueues = std::deque<std::function<void()>>[kPrioritiesCount];
+
+  struct Worker {
+    std::mutex mutex;
+    TaskQueues queues;
+    std::thread thread;
+    // Start of running task in nanoseconds of steady clock, or zero.
+    std::atomic<int64_t> task_start_ns = 0;
+    // Total duration of finished tasks.
+    std::atomic<int64_t> busy_ns = 0;
+  };
+
+  void Run(size_t worker_index) noexcept;
+  // Takes task with priority not lower then |lowest_priority|.
+  bool TakeTask(
+      TaskPriority lowest_priority,
+      std::function<void()>* task,
+      TaskPriority* priority) noexcept;
+  // Runs |task| on current worker thread.
+  void RunTask(
+      const std::function<void()>& task, TaskPriority priority) noexcept;
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::mutex shared_mutex_;
+  TaskQueues shared_queues_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_cv_;
+  std::atomic<size_t> queued_tasks_count_ = 0;
+  bool stopping_ = false;
+  std::mutex stats_mutex_;
+  int64_t last_stats_ns_ = 0;
+  int64_t last_stats_busy_ns_ = 0;
+};
+
+}  // namespace oko
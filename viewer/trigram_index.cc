@@ -0,0 +1,402 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/trigram_index.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <string>
+#include <iterator>
+#include <unordered_map>
+#include <utility>
+
+#include "viewer/error_codes.h"
+#include "viewer/log_index_file.h"
+#include "viewer/parallel_for.h"
+
+namespace oko {
+
+namespace {
+
+const char kTrigramIndexFileExtension[] = ".okotri";
+const char kMagic[8] = {'O', 'K', 'O', 'T', 'R', 'I', '\0', '\0'};
+// Must be increased when trigrams or blocks are computed differently.
+const uint32_t kVersion = 2;
+// Number of blocks, which trigrams are collected in memory before
+// adding them to posting lists.
+const size_t kBlocksPerRound = 1024;
+
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t records_per_block;
+  uint64_t log_file_size;
+  int64_t log_file_mtime;
+  uint64_t records_count;
+  // Identity of log index, that indexed records were read from.
+  uint64_t log_index_id;
+  uint64_t trigrams_count;
+  uint64_t postings_size;
+};
+
+static_assert(sizeof(IndexHeader) == 64, "Unexpected padding in header");
+
+uint32_t TrigramAt(std::string_view message, size_t pos) noexcept {
+  return static_cast<uint32_t>(static_cast<uint8_t>(message[pos])) << 16 |
+      static_cast<uint32_t>(static_cast<uint8_t>(message[pos + 1])) << 8 |
+      static_cast<uint32_t>(static_cast<uint8_t>(message[pos + 2]));
+}
+
+// Fills |trigrams| with sorted unique trigrams of messages of records
+// [first_record, last_record).
+void CollectTrigrams(
+    const RecordStore& store,
+    size_t first_record,
+    size_t last_record,
+    std::vector<uint32_t>* trigrams) noexcept {
+  trigrams->clear();
+  for (size_t i = first_record; i < last_record; ++i) {
+    const std::string_view message = store.message(i);
+    for (size_t pos = 0; pos + 2 < message.size(); ++pos) {
+      trigrams->push_back(TrigramAt(message, pos));
+    }
+  }
+  std::sort(trigrams->begin(), trigrams->end());
+  trigrams->erase(
+      std::unique(trigrams->begin(), trigrams->end()),
+      trigrams->end());
+}
+
+template<typename T>
+void WriteVector(std::ofstream& file, const std::vector<T>& v) noexcept {
+  file.write(reinterpret_cast<const char*>(v.data()), v.size() * sizeof(T));
+}
+
+template<typename T>
+const char* ReadVector(
+    const char* data, size_t count, std::vector<T>* v) noexcept {
+  v->resize(count);
+  std::memcpy(v->data(), data, count * sizeof(T));
+  return data + count * sizeof(T);
+}
+
+}  // namespace
+
+class TrigramIndex::PostingListBuilder {
+ public:
+  void Add(uint32_t block) noexcept {
+    uint32_t delta = count_ == 0 ? block : block - last_block_;
+    while (delta >= 0x80) {
+      data_.push_back(static_cast<uint8_t>(delta | 0x80));
+      delta >>= 7;
+    }
+    data_.push_back(static_cast<uint8_t>(delta));
+    last_block_ = block;
+    ++count_;
+  }
+
+  const std::vector<uint8_t>& data() const noexcept {
+    return data_;
+  }
+
+  uint32_t count() const noexcept {
+    return count_;
+  }
+
+ private:
+  std::vector<uint8_t> data_;
+  uint32_t last_block_ = 0;
+  uint32_t count_ = 0;
+};
+
+// static
+TrigramIndex TrigramIndex::Build(
+    const RecordStore& store,
+    const std::atomic<bool>& cancelled) noexcept {
+  const size_t blocks_count =
+      (store.size() + kRecordsPerBlock - 1) / kRecordsPerBlock;
+  const size_t threads_count = GetParallelism();
+  // Items are trigram in high 32 bits and block index in low 32 bits.
+  std::vector<std::vector<uint64_t>> thread_entries(threads_count);
+  std::unordered_map<uint32_t, PostingListBuilder> posting_lists;
+  for (size_t round_start = 0; round_start < blocks_count;
+       round_start += kBlocksPerRound) {
+    if (cancelled) {
+      return {};
+    }
+    const size_t round_size = std::min(
+        kBlocksPerRound, blocks_count - round_start);
+    ParallelFor(
+        threads_count,
+        [&store, &thread_entries, round_start, round_size, threads_count](
+            size_t thread_index) {
+          std::vector<uint64_t>& entries = thread_entries[thread_index];
+          entries.clear();
+          std::vector<uint32_t> block_trigrams;
+          const size_t first_block = round_start +
+              round_size * thread_index / threads_count;
+          const size_t last_block = round_start +
+              round_size * (thread_index + 1) / threads_count;
+          for (size_t block = first_block; block < last_block; ++block) {
+            CollectTrigrams(
+                store,
+                block * kRecordsPerBlock,
+                std::min(store.size(), (block + 1) * kRecordsPerBlock),
+                &block_trigrams);
+            for (uint32_t trigram : block_trigrams) {
+              entries.push_back(static_cast<uint64_t>(trigram) << 32 | block);
+            }
+          }
+          std::sort(entries.begin(), entries.end());
+        });
+    // Threads processed increasing ranges of blocks, so adding their
+    // entries in order of threads keeps posting lists sorted.
+    for (const std::vector<uint64_t>& entries : thread_entries) {
+      for (size_t i = 0; i < entries.size();) {
+        const uint32_t trigram = static_cast<uint32_t>(entries[i] >> 32);
+        PostingListBuilder& posting_list = posting_lists[trigram];
+        for (; i < entries.size() && (entries[i] >> 32) == trigram; ++i) {
+          posting_list.Add(static_cast<uint32_t>(entries[i]));
+        }
+      }
+    }
+  }
+  TrigramIndex result;
+  result.records_count_ = store.size();
+  result.trigrams_.reserve(posting_lists.size());
+  for (const auto& item : posting_lists) {
+    result.trigrams_.push_back(item.first);
+  }
+  std::sort(result.trigrams_.begin(), result.trigrams_.end());
+  result.posting_counts_.reserve(result.trigrams_.size());
+  result.posting_offsets_.reserve(result.trigrams_.size() + 1);
+  for (uint32_t trigram : result.trigrams_) {
+    const PostingListBuilder& posting_list = posting_lists[trigram];
+    result.posting_counts_.push_back(posting_list.count());
+    result.posting_offsets_.push_back(result.postings_.size());
+    result.postings_.insert(
+        result.postings_.end(),
+        posting_list.data().begin(),
+        posting_list.data().end());
+  }
+  result.posting_offsets_.push_back(result.postings_.size());
+  return result;
+}
+
+// static
+std::filesystem::path TrigramIndex::PathForLogIndexFile(
+    const std::filesystem::path& log_index_file_path) noexcept {
+  std::filesystem::path result = log_index_file_path;
+  result.replace_extension(kTrigramIndexFileExtension);
+  return result;
+}
+
+std::error_code TrigramIndex::Write(
+    const std::filesystem::path& index_file_path,
+    const std::filesystem::path& log_file_path,
+    uint64_t log_index_id) const noexcept {
+  std::error_code ec;
+  const auto log_file_size = std::filesystem::file_size(log_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  auto maybe_mtime = LogIndexFile::GetLogFileMTime(log_file_path);
+  if (!maybe_mtime) {
+    return maybe_mtime.error();
+  }
+  IndexHeader header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.records_per_block = kRecordsPerBlock;
+  header.log_file_size = log_file_size;
+  header.log_file_mtime = maybe_mtime.value();
+  header.records_count = records_count_;
+  header.log_index_id = log_index_id;
+  header.trigrams_count = trigrams_.size();
+  header.postings_size = postings_.size();
+
+  std::filesystem::path tmp_file_path = index_file_path;
+  // Other processes may write index of the same file at once.
+  tmp_file_path.concat(".tmp" + std::to_string(getpid()));
+  {
+    std::ofstream dst_file(
+        tmp_file_path,
+        std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!dst_file.is_open()) {
+      return std::error_code(errno, std::generic_category());
+    }
+    dst_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    WriteVector(dst_file, trigrams_);
+    WriteVector(dst_file, posting_counts_);
+    WriteVector(dst_file, posting_offsets_);
+    WriteVector(dst_file, postings_);
+    if (!dst_file) {
+      std::filesystem::remove(tmp_file_path, ec);
+      return ErrorCodes::kFailedWriteFile;
+    }
+  }
+  std::filesystem::rename(tmp_file_path, index_file_path, ec);
+  return ec;
+}
+
+// static
+std::error_code TrigramIndex::Read(
+    const std::filesystem::path& index_file_path,
+    const std::filesystem::path& log_file_path,
+    uint64_t log_index_id,
+    size_t records_count,
+    TrigramIndex* result) noexcept {
+  std::error_code ec;
+  const auto index_file_size = std::filesystem::file_size(
+      index_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  const auto log_file_size = std::filesystem::file_size(log_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  if (index_file_size < sizeof(IndexHeader)) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  auto maybe_mtime = LogIndexFile::GetLogFileMTime(log_file_path);
+  if (!maybe_mtime) {
+    return maybe_mtime.error();
+  }
+  boost::iostreams::mapped_file_source mapped_file;
+  try {
+    // Throws if file was removed or truncated after its size was checked.
+    mapped_file.open(index_file_path);
+  } catch (const std::exception&) {
+    return ErrorCodes::kFailedMapFile;
+  }
+  if (!mapped_file.is_open()) {
+    return ErrorCodes::kFailedMapFile;
+  }
+  if (mapped_file.size() != index_file_size) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  IndexHeader header;
+  std::memcpy(&header, mapped_file.data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion ||
+      header.records_per_block != kRecordsPerBlock ||
+      header.log_file_size != log_file_size ||
+      header.log_file_mtime != maybe_mtime.value() ||
+      header.records_count != records_count ||
+      header.log_index_id != log_index_id ||
+      header.trigrams_count > index_file_size ||
+      header.postings_size > index_file_size ||
+      index_file_size != sizeof(IndexHeader) +
+          header.trigrams_count * (2 * sizeof(uint32_t)) +
+          (header.trigrams_count + 1) * sizeof(uint64_t) +
+          header.postings_size) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  TrigramIndex index;
+  index.records_count_ = header.records_count;
+  const char* data = mapped_file.data() + sizeof(IndexHeader);
+  data = ReadVector(data, header.trigrams_count, &index.trigrams_);
+  data = ReadVector(data, header.trigrams_count, &index.posting_counts_);
+  data = ReadVector(
+      data, header.trigrams_count + 1, &index.posting_offsets_);
+  ReadVector(data, header.postings_size, &index.postings_);
+  const size_t blocks_count =
+      (index.records_count_ + kRecordsPerBlock - 1) / kRecordsPerBlock;
+  if (index.posting_offsets_.front() != 0 ||
+      index.posting_offsets_.back() != header.postings_size ||
+      !std::is_sorted(
+          index.posting_offsets_.begin(), index.posting_offsets_.end()) ||
+      std::any_of(
+          index.posting_counts_.begin(),
+          index.posting_counts_.end(),
+          [blocks_count](uint32_t count) {
+            return count > blocks_count;
+          })) {
+    return ErrorCodes::kFileFormatCorrupted;
+  }
+  *result = std::move(index);
+  return ErrorCodes::kOk;
+}
+
+TrigramIndex::Candidates TrigramIndex::FindCandidates(
+    std::string_view pattern) const noexcept {
+  Candidates result;
+  if (pattern.size() < 3) {
+    return result;
+  }
+  std::vector<uint32_t> pattern_trigrams;
+  for (size_t pos = 0; pos + 2 < pattern.size(); ++pos) {
+    pattern_trigrams.push_back(TrigramAt(pattern, pos));
+  }
+  std::sort(pattern_trigrams.begin(), pattern_trigrams.end());
+  pattern_trigrams.erase(
+      std::unique(pattern_trigrams.begin(), pattern_trigrams.end()),
+      pattern_trigrams.end());
+  result.all_records_ = false;
+  result.blocks_.resize(
+      (records_count_ + kRecordsPerBlock - 1) / kRecordsPerBlock, false);
+  std::vector<size_t> trigram_indexes;
+  for (uint32_t trigram : pattern_trigrams) {
+    const auto it = std::lower_bound(
+        trigrams_.begin(), trigrams_.end(), trigram);
+    if (it == trigrams_.end() || *it != trigram) {
+      // No record contains this trigram.
+      return result;
+    }
+    trigram_indexes.push_back(it - trigrams_.begin());
+  }
+  // Intersect shortest lists first, to keep intermediate results small.
+  std::sort(
+      trigram_indexes.begin(),
+      trigram_indexes.end(),
+      [this](size_t first, size_t second) {
+        return posting_counts_[first] < posting_counts_[second];
+      });
+  std::vector<uint32_t> blocks, other_blocks, intersection;
+  DecodePostingList(trigram_indexes[0], &blocks);
+  for (size_t i = 1; i < trigram_indexes.size() && !blocks.empty(); ++i) {
+    DecodePostingList(trigram_indexes[i], &other_blocks);
+    intersection.clear();
+    std::set_intersection(
+        blocks.begin(), blocks.end(),
+        other_blocks.begin(), other_blocks.end(),
+        std::back_inserter(intersection));
+    blocks.swap(intersection);
+  }
+  for (uint32_t block : blocks) {
+    if (block < result.blocks_.size()) {
+      result.blocks_[block] = true;
+    }
+  }
+  return result;
+}
+
+void TrigramIndex::DecodePostingList(
+    size_t trigram_index, std::vector<uint32_t>* blocks) const noexcept {
+  blocks->clear();
+  blocks->reserve(posting_counts_[trigram_index]);
+  const uint8_t* data = postings_.data() + posting_offsets_[trigram_index];
+  const uint8_t* end = postings_.data() + posting_offsets_[trigram_index + 1];
+  uint32_t block = 0;
+  while (data < end) {
+    uint32_t delta = 0;
+    for (int shift = 0; data < end && shift < 32; shift += 7) {
+      const uint8_t byte = *data++;
+      delta |= static_cast<uint32_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        break;
+      }
+    }
+    block += delta;
+    blocks->push_back(block);
+  }
+}
+
+}  // namespace oko
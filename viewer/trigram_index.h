@@ -0,0 +1,102 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "viewer/record_store.h"
+
+namespace oko {
+
+// Inverted index from trigrams (sequences of 3 bytes) of record messages
+// to records, that contain them. Allows to skip most records when
+// searching for rare patterns. To keep index small, records are indexed
+// by blocks of |kRecordsPerBlock| consecutive records.
+class TrigramIndex {
+ public:
+  static constexpr size_t kRecordsPerBlock = 128;
+
+  // Records, that may contain some pattern.
+  class Candidates {
+   public:
+    // Creates candidates set, that includes all records.
+    Candidates() noexcept = default;
+
+    // Returns false if record |store_index| definitely does not contain
+    // the pattern.
+    bool MayContain(size_t store_index) const noexcept {
+      return all_records_ || blocks_[store_index / kRecordsPerBlock];
+    }
+
+   private:
+    friend class TrigramIndex;
+
+    bool all_records_ = true;
+    std::vector<bool> blocks_;
+  };
+
+  TrigramIndex() noexcept = default;
+  TrigramIndex(TrigramIndex&&) noexcept = default;
+  TrigramIndex& operator = (TrigramIndex&&) noexcept = default;
+
+  // Builds index of all records of |store| on several threads.
+  // Returns empty index if |cancelled| is set during build.
+  static TrigramIndex Build(
+      const RecordStore& store,
+      const std::atomic<bool>& cancelled) noexcept;
+
+  // Returns path of trigram index file, that corresponds to log index
+  // file |log_index_file_path|.
+  static std::filesystem::path PathForLogIndexFile(
+      const std::filesystem::path& log_index_file_path) noexcept;
+
+  // Writes index, built for records of log file |log_file_path|, that
+  // were read from or written to log index |log_index_id|.
+  std::error_code Write(
+      const std::filesystem::path& index_file_path,
+      const std::filesystem::path& log_file_path,
+      uint64_t log_index_id) const noexcept;
+
+  // Reads index from file. Fails if index is missed, corrupted, or was
+  // built for other version of the log file, for records of other log
+  // index or for other number of records.
+  static std::error_code Read(
+      const std::filesystem::path& index_file_path,
+      const std::filesystem::path& log_file_path,
+      uint64_t log_index_id,
+      size_t records_count,
+      TrigramIndex* result) noexcept;
+
+  // Number of indexed records.
+  size_t records_count() const noexcept {
+    return records_count_;
+  }
+
+  Candidates FindCandidates(std::string_view pattern) const noexcept;
+
+ private:
+  class PostingListBuilder;
+
+  void DecodePostingList(
+      size_t trigram_index, std::vector<uint32_t>* blocks) const noexcept;
+
+  size_t records_count_ = 0;
+  // Sorted trigrams, that occur in at least one record.
+  std::vector<uint32_t> trigrams_;
+  // Number of blocks, that contain each trigram.
+  std::vector<uint32_t> posting_counts_;
+  // Posting list of |trigrams_[i]| occupies bytes from
+  // |posting_offsets_[i]| to |posting_offsets_[i + 1]| of |postings_|.
+  std::vector<uint64_t> posting_offsets_;
+  // Increasing block indexes, encoded as differences with previous
+  // index in LEB128 format.
+  std::vector<uint8_t> postings_;
+};
+
+}  // namespace oko
@@ -10,6 +10,7 @@
 
 #include "viewer/log_level_filter.h"
 #include "viewer/ui/ncurses_helpers.h"
+#include "viewer/ui/progress_window.h"
 
 namespace oko {
 
@@ -102,11 +103,23 @@ void AddLevelFilterDialog::DisplayImpl() noexcept {
 }
 
 bool AddLevelFilterDialog::HandleEnter() noexcept {
-  std::unique_ptr<LogLevelFilter> new_filter =
-      std::make_unique<LogLevelFilter>(
-          &app_model_->active_view(),
-          std::move(checked_levels_));
-  app_model_->AppendFilter(std::move(new_filter));
+  const LogView* parent_view = &app_model_->active_view();
+  std::unique_ptr<LogLevelFilter> new_filter = RunWithProgress(
+      "Applying filter...",
+      [parent_view, this](Progress* progress) {
+        auto filter = std::make_unique<LogLevelFilter>(
+            parent_view,
+            std::move(checked_levels_),
+            progress);
+        if (progress->is_cancelled()) {
+          filter.reset();
+        }
+        return filter;
+      });
+  // Filter is not applied, if user cancelled it.
+  if (new_filter) {
+    app_model_->AppendFilter(std::move(new_filter));
+  }
   return true;
 }
 
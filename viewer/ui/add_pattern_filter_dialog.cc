@@ -9,6 +9,7 @@
 #include <boost/algorithm/string/trim.hpp>
 
 #include "viewer/log_pattern_filter.h"
+#include "viewer/ui/progress_window.h"
 
 namespace oko {
 
@@ -30,11 +31,27 @@ bool AddPatternFilterDialog::HandleEnter() noexcept {
   std::string entered_string = field_buffer(fields_[0], 0);
   boost::algorithm::trim_right(entered_string);
   if (!entered_string.empty()) {
-    app_model_->AppendFilter(
-        std::make_unique<LogPatternFilter>(
-            &app_model_->active_view(),
-            std::move(entered_string),
-            is_include_filter_));
+    const LogView* parent_view = &app_model_->active_view();
+    const TrigramIndex* text_index = app_model_->text_index();
+    std::unique_ptr<LogPatternFilter> new_filter = RunWithProgress(
+        "Applying filter...",
+        [parent_view, text_index, &entered_string, this](
+            Progress* progress) {
+          auto filter = std::make_unique<LogPatternFilter>(
+              parent_view,
+              entered_string,
+              is_include_filter_,
+              text_index,
+              progress);
+          if (progress->is_cancelled()) {
+            filter.reset();
+          }
+          return filter;
+        });
+    // Filter is not applied, if user cancelled it.
+    if (new_filter) {
+      app_model_->AppendFilter(std::move(new_filter));
+    }
   }
   return true;
 }
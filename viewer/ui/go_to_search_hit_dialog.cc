@@ -0,0 +1,56 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#include "viewer/ui/go_to_search_hit_dialog.h"
+
+#include <algorithm>
+#include <boost/algorithm/string/trim.hpp>
+#include <boost/format.hpp>
+#include <charconv>
+#include <limits>
+
+namespace oko {
+
+GoToSearchHitDialog::GoToSearchHitDialog(AppModel* model) noexcept
+    : DialogWindow(1),
+      app_model_(model) {
+  fields_[0] = new_field(1, std::max(1, width_ - 4), 1, 1, 0, 0);
+  set_field_back(fields_[0], A_REVERSE);
+  // TYPE_INTEGER takes precision as int and range bounds as long.
+  set_field_type(
+      fields_[0],
+      TYPE_INTEGER,
+      0,
+      1L,
+      static_cast<long>(std::numeric_limits<int>::max()));
+  InitForm();
+}
+
+bool GoToSearchHitDialog::HandleEnter() noexcept {
+  std::string buffer_data = field_buffer(fields_[0], 0);
+  boost::algorithm::trim(buffer_data);
+  size_t hit_number = 0;
+  auto res = std::from_chars(
+      buffer_data.data(),
+      buffer_data.data() + buffer_data.size(),
+      hit_number);
+  if (res.ec != std::errc() ||
+      res.ptr != buffer_data.data() + buffer_data.size() ||
+      hit_number == 0 ||
+      hit_number > app_model_->search_hits_count()) {
+    return false;
+  }
+  app_model_->SelectSearchHit(hit_number - 1);
+  return true;
+}
+
+std::string GoToSearchHitDialog::GetTitle() const noexcept {
+  if (!app_model_->has_search_hits()) {
+    return "Go to match (matches are not counted yet)";
+  }
+  return boost::str(boost::format("Go to match (1-%1%)") %
+      app_model_->search_hits_count());
+}
+
+}  // namespace oko
@@ -0,0 +1,27 @@
+// Copyright 2020 The "Oko" project authors. All rights reserved.
+// Use of this source code is governed by a MIT license that can be
+// found in the LICENSE file.
+
+#pragma once
+#include <form.h>
+
+#include <string>
+
+#include "viewer/app_model.h"
+#include "viewer/ui/dialog_window.h"
+
+namespace oko {
+
+// Asks number of search match and selects it.
+class GoToSearchHitDialog : public DialogWindow {
+ public:
+  explicit GoToSearchHitDialog(AppModel* model) noexcept;
+
+ private:
+  bool HandleEnter() noexcept override;
+  std::string GetTitle() const noexcept override;
+
+  AppModel* app_model_;
+};
+
+}  // namespace oko
@@ -9,11 +9,15 @@
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/format.hpp>
 #include <charconv>
+#include <chrono>
 #include <future>
+#include <iterator>
 #include <memory>
+#include <optional>
 #include <unordered_set>
 #include <utility>
 
+#include "viewer/thread_pool.h"
 #include "viewer/ui/color_manager.h"
 #include "viewer/ui/message_window.h"
 #include "viewer/ui/progress_window.h"
@@ -22,57 +26,132 @@ namespace oko {
 
 LogFilesWindow::LogFilesWindow(
     LogFilesProvider* files_provider,
+    LogFilesLoader::Options loader_options,
     int start_row,
     int start_col,
     int num_rows,
     int num_columns)
     : Window(start_row, start_col, num_rows, num_columns),
-      files_provider_(files_provider) {
-  std::future<outcome::std_result<std::vector<LogFileInfo>>> get_file_infos_async =
-      std::async(
-        std::launch::async,
-        [files_provider]() {
-          return files_provider->GetLogFileInfos();
-        });
+      files_provider_(files_provider),
+      loader_options_(std::move(loader_options)) {
+  ColorManager& cm = ColorManager::instance();
+  selected_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_WHITE);
+  selected_marked_color_pair_ = cm.RegisterColorPair(COLOR_WHITE, COLOR_RED);
+  marked_color_pair_ = cm.RegisterColorPair(COLOR_YELLOW, COLOR_RED);
+  listing_result_ = ThreadPool::instance().Submit(
+      TaskPriority::kInteractive,
+      [this] {
+        return files_provider_->ListLogFiles(
+            [this](std::vector<LogFileInfo> file_infos) {
+              std::lock_guard<std::mutex> lock(listed_file_infos_mutex_);
+              std::move(
+                  file_infos.begin(),
+                  file_infos.end(),
+                  std::back_inserter(listed_file_infos_));
+            },
+            &listing_progress_);
+      });
   {
+    // Wait only until there are some files to choose.
     ProgressWindow progress_window(
         "Retrieving file list...",
-        [&get_file_infos_async] {
-            return get_file_infos_async.wait_for(
-                std::chrono::seconds(0)) == std::future_status::ready;
-        });
+        [this] {
+            if (listing_result_.wait_for(
+                    std::chrono::seconds(0)) == std::future_status::ready) {
+              return true;
+            }
+            std::lock_guard<std::mutex> lock(listed_file_infos_mutex_);
+            return !listed_file_infos_.empty();
+        },
+        &listing_progress_);
     progress_window.PostSync();
     Display();
   }
-  auto maybe_file_infos = get_file_infos_async.get();
-  if (!maybe_file_infos) {
+  if (listing_progress_.is_cancelled()) {
+    listing_result_.wait();
+    finished_ = true;
+    return;
+  }
+  Update();
+}
+
+LogFilesWindow::~LogFilesWindow() {
+  if (listing_result_.valid()) {
+    listing_progress_.Cancel();
+    listing_result_.wait();
+  }
+}
+
+void LogFilesWindow::Update() noexcept {
+  if (finished_) {
+    return;
+  }
+  // Result is checked first, so files, passed before listing finished,
+  // are not missed.
+  std::optional<std::error_code> listing_error;
+  if (listing_result_.valid() &&
+      listing_result_.wait_for(
+          std::chrono::seconds(0)) == std::future_status::ready) {
+    listing_error = listing_result_.get();
+  }
+  std::vector<LogFileInfo> listed_file_infos;
+  {
+    std::lock_guard<std::mutex> lock(listed_file_infos_mutex_);
+    listed_file_infos.swap(listed_file_infos_);
+  }
+  AddFileInfos(std::move(listed_file_infos));
+  if (!listing_error) {
+    return;
+  }
+  if (*listing_error) {
     MessageWindow::PostSync(boost::str(boost::format(
         "Failed retrieve file list. %1%.") %
-            maybe_file_infos.error().message()));
-    finished_ = true;
+            listing_error->message()));
+    // Files, listed before error, still may be chosen.
+    if (file_infos_.empty()) {
+      finished_ = true;
+    }
     return;
   }
-  file_infos_.reserve(maybe_file_infos.value().size());
-  file_infos_.insert(
-      file_infos_.begin(),
-      maybe_file_infos.value().begin(),
-      maybe_file_infos.value().end());
   if (file_infos_.empty()) {
     MessageWindow::PostSync("Don't found any log files under specified path");
     finished_ = true;
-    return;
   }
+}
 
-  std::sort(
-      file_infos_.begin(),
-      file_infos_.end(),
+void LogFilesWindow::AddFileInfos(
+    std::vector<LogFileInfo> file_infos) noexcept {
+  if (file_infos.empty()) {
+    return;
+  }
+  const auto name_less =
       [](const LogFileInfo& first, const LogFileInfo& second) {
         return first.name < second.name;
-      });
-  ColorManager& cm = ColorManager::instance();
-  selected_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_WHITE);
-  selected_marked_color_pair_ = cm.RegisterColorPair(COLOR_WHITE, COLOR_RED);
-  marked_color_pair_ = cm.RegisterColorPair(COLOR_YELLOW, COLOR_RED);
+      };
+  std::sort(file_infos.begin(), file_infos.end(), name_less);
+  std::optional<std::string> selected_name;
+  if (!file_infos_.empty()) {
+    selected_name = file_infos_[selected_item_].name;
+  }
+  const size_t old_size = file_infos_.size();
+  file_infos_.reserve(old_size + file_infos.size());
+  for (const LogFileInfo& file_info : file_infos) {
+    file_infos_.emplace_back(file_info);
+  }
+  std::inplace_merge(
+      file_infos_.begin(),
+      file_infos_.begin() + old_size,
+      file_infos_.end(),
+      name_less);
+  // Selection stays on the same file.
+  if (selected_name) {
+    const auto it = std::lower_bound(
+        file_infos_.begin(),
+        file_infos_.end(),
+        LogFileInfo{*selected_name, 0},
+        name_less);
+    SetSelectedItem(it - file_infos_.begin());
+  }
 }
 
 void LogFilesWindow::HandleKeyPress(int key) noexcept {
@@ -136,7 +215,9 @@ void LogFilesWindow::DisplayImpl() noexcept {
 
 void LogFilesWindow::DisplayTitle() noexcept {
   mvwhline(window_.get(), 0, 0, 0, num_columns_);
-  mvwaddstr(window_.get(), 0, 1, "Log file name");
+  mvwaddstr(
+      window_.get(), 0, 1,
+      is_listing() ? "Log file name (listing...)" : "Log file name");
   const std::string_view kFileSize{"File size"};
   if (num_columns_ > kFileSize.size() + 1) {
     mvwaddstr(
@@ -177,41 +258,43 @@ void LogFilesWindow::SetSelectedItem(size_t new_item) noexcept {
 }
 
 void LogFilesWindow::Finish() noexcept {
-  std::vector<outcome::std_result<std::unique_ptr<LogFile>>> maybe_files;
-  maybe_files.reserve(file_infos_.size());
-  std::future<void> fetch_async =
-      std::async(
-        std::launch::async,
-        [this, &maybe_files] {
-          for (size_t i = 0; i < file_infos_.size(); ++i) {
-            if (i == selected_item_ || file_infos_[i].is_marked) {
-              auto fetch_result = files_provider_->FetchLog(
-                  file_infos_[i].name);
-              maybe_files.emplace_back(std::move(fetch_result));
-            }
-          }
-        });
+  std::vector<LogFileInfo> fetched_infos;
+  for (size_t i = 0; i < file_infos_.size(); ++i) {
+    if (i == selected_item_ || file_infos_[i].is_marked) {
+      fetched_infos.push_back(file_infos_[i]);
+    }
+  }
+  // Files are fetched, decompressed and parsed in pipeline, so window
+  // waits only until the last file is decompressed.
+  // Options are copied, since files are chosen again after cancellation.
+  LogFilesLoader loader(
+      files_provider_,
+      fetched_infos,
+      loader_options_);
   {
     ProgressWindow progress_window(
         "Fetching files...",
-        [&fetch_async] {
-            return fetch_async.wait_for(
-                std::chrono::seconds(0)) == std::future_status::ready;
-        });
+        [&loader] {
+            return loader.is_opened();
+        },
+        &loader.progress());
     progress_window.PostSync();
     Display();
   }
-  fetch_async.get();
+  if (loader.progress().is_cancelled()) {
+    // Files are dropped, when their cancelled parsing stops. User may
+    // choose files again.
+    std::vector<std::unique_ptr<LogFile>> cancelled_files =
+        loader.RetrieveOpenedFiles();
+    loader.RetrieveParseResult().wait();
+    return;
+  }
+  fetched_files_ = loader.RetrieveOpenedFiles();
+  parse_result_ = loader.RetrieveParseResult();
+  parse_progress_ = loader.shared_progress();
   std::unordered_set<std::error_code> errors;
-  fetched_files_.clear();
-  if (!maybe_files.empty()) {
-    for (auto& maybe_file : maybe_files) {
-      if (!maybe_file) {
-        errors.emplace(std::move(maybe_file.error()));
-      } else {
-        fetched_files_.emplace_back(std::move(maybe_file.value()));
-      }
-    }
+  for (std::error_code& error : loader.open_errors()) {
+    errors.emplace(std::move(error));
   }
   if (!errors.empty()) {
     std::stringstream message_buf;
@@ -3,36 +3,64 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "viewer/log_files_loader.h"
 #include "viewer/log_files_provider.h"
 #include "viewer/ui/window.h"
 
 namespace oko {
 
+// Shows files of |LogFilesProvider|. Files appear while they are
+// listed, so they may be chosen before listing finishes.
 class LogFilesWindow : public Window {
  public:
+  // Chosen files are loaded with |loader_options|.
   LogFilesWindow(
       LogFilesProvider* files_provider,
+      LogFilesLoader::Options loader_options,
       int start_row,
       int start_col,
       int num_rows,
       int num_columns);
+  // Waits until cancelled listing stops.
+  ~LogFilesWindow();
 
   void HandleKeyPress(int key) noexcept override;
 
+  // Shows files, listed since previous call, and reports result of
+  // listing when it finishes.
+  void Update() noexcept;
+
+  bool is_listing() const noexcept {
+    return listing_result_.valid();
+  }
+
   bool finished() const noexcept {
     return finished_;
   }
 
+  // Fetched files may be still parsed, until result of
+  // |RetrieveParseResult| is ready.
   std::vector<std::unique_ptr<LogFile>> RetrieveFetchedFiles() noexcept {
     return std::move(fetched_files_);
   }
 
+  std::future<std::error_code> RetrieveParseResult() noexcept {
+    return std::move(parse_result_);
+  }
+
+  // Cancelling returned progress stops parsing of fetched files.
+  std::shared_ptr<Progress> RetrieveParseProgress() noexcept {
+    return std::move(parse_progress_);
+  }
+
   void SearchForFilesBySubstring(std::string str) noexcept;
   void SearchNextEntry() noexcept;
   void SearchPrevEntry() noexcept;
@@ -43,8 +71,10 @@ class LogFilesWindow : public Window {
   void SetSelectedItem(size_t new_item) noexcept;
   void DisplayItem(int row, const LogFileInfo& info) noexcept;
   void Finish() noexcept;
+  void AddFileInfos(std::vector<LogFileInfo> file_infos) noexcept;
 
   LogFilesProvider* files_provider_;
+  LogFilesLoader::Options loader_options_;
   bool finished_ = false;
   size_t selected_item_ = 0;
   size_t first_shown_item_ = 0;
@@ -52,14 +82,23 @@ class LogFilesWindow : public Window {
   int selected_marked_color_pair_ = 0;
   int marked_color_pair_ = 0;
   std::vector<std::unique_ptr<LogFile>> fetched_files_;
+  std::future<std::error_code> parse_result_;
+  std::shared_ptr<Progress> parse_progress_;
 
   struct LogFileInfoAndMark : public LogFileInfo {
-    LogFileInfoAndMark(LogFileInfo& second)
+    LogFileInfoAndMark(const LogFileInfo& second)
         : LogFileInfo(second) {}
 
     bool is_marked = false;
   };
+  // Sorted by name.
   std::vector<LogFileInfoAndMark> file_infos_;
+  // Used only to cancel listing.
+  Progress listing_progress_;
+  std::future<std::error_code> listing_result_;
+  std::mutex listed_file_infos_mutex_;
+  // Files, listed by background task and not shown yet.
+  std::vector<LogFileInfo> listed_file_infos_;
   std::optional<std::string> string_to_search_;
 };
 
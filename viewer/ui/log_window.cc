@@ -119,7 +119,7 @@ LogWindow::~LogWindow() = default;
 
 void LogWindow::DisplayImpl() noexcept {
   const size_t after_last_record = GetDisplayedRecordAfterLast();
-  const std::vector<LogRecord>& records = view_->GetRecords();
+  const RecordsAccessor records = view_->GetRecords();
   const size_t selected_record = app_model_->selected_record();
   for (size_t i = first_shown_record_, row = 0;
       i < after_last_record; ++i, ++row) {
@@ -132,13 +132,13 @@ void LogWindow::DisplayImpl() noexcept {
     }
     wmove(window_.get(), row, 0);
 
-    DisplayTime(is_marked, records[i].timestamp());
+    DisplayTime(is_marked, records.timestamp(i));
     waddch(window_.get(), ' ');
 
-    DisplayLevel(is_marked, records[i].log_level());
+    DisplayLevel(is_marked, records.log_level(i));
     waddch(window_.get(), ' ');
 
-    DisplayMessage(records[i].message());
+    DisplayMessage(records.message(i));
     wclrtoeol(window_.get());
 
     if (is_marked) {
@@ -225,8 +225,9 @@ void LogWindow::DisplayMessage(const std::string_view& message) noexcept {
       message.data() + message.size());
   part_to_display = boost::algorithm::replace_all_copy(
       part_to_display, "\n", "\\n");
-  const std::string& search_text = app_model_->search_text();
-  size_t search_index = part_to_display.find(search_text);
+  const SubstringMatcher& search_matcher = app_model_->search_matcher();
+  const std::string& search_text = search_matcher.pattern();
+  size_t search_index = search_matcher.Find(part_to_display);
   if (search_text.empty() || search_index == std::string_view::npos) {
     waddnstr(
         window_.get(),
@@ -246,7 +247,7 @@ void LogWindow::DisplayMessage(const std::string_view& message) noexcept {
             search_text.size());
         part_to_display = part_to_display.substr(
             search_index + search_text.size());
-        search_index = part_to_display.find(search_text);
+        search_index = search_matcher.Find(part_to_display);
       } else {
         break;
       }
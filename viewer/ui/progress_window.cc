@@ -7,7 +7,6 @@
 #include <algorithm>
 #include <boost/format.hpp>
 #include <chrono>
-#include <thread>
 #include <vector>
 #include <utility>
 
@@ -20,37 +19,52 @@ namespace {
 
 const int kDesiredWindowWidth = 70;
 const int kSliderWidth = 2;
+// Height without stage rows.
 const int kDesiredWindowHeight = 7;
 const int kProgressRow = 2;
 const int kTextRow = 4;
+const int kRefreshIntervalMs = 150;
 
 }  // namespace
 
 ProgressWindow::ProgressWindow(
-    const std::string& title, IsReadyCallback cb) noexcept
+    const std::string& title,
+    IsReadyCallback cb,
+    Progress* progress) noexcept
     : Window(1, 1, 1, 1),
       title_(" " + title + " "),
-      is_ready_callback_(std::move(cb)) {
+      is_ready_callback_(std::move(cb)),
+      progress_(progress) {
+  UpdateStartedStages();
+  Layout();
+
+  ColorManager& cm = ColorManager::instance();
+  bg_progress_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_YELLOW);
+  fg_progress_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_RED);
+}
+
+void ProgressWindow::Layout() noexcept {
   int max_row = 0, max_col = 0;
   getmaxyx(stdscr, max_row, max_col);
   int width = std::min(kDesiredWindowWidth, max_col);
   progress_width_ = std::max(0, width - 4);
   // Can not shrink vertically.
+  const int height = kDesiredWindowHeight + started_stages_.size();
   const int start_col = std::max(0, (max_col - width) / 2);
-  const int start_row = std::max(0, (max_row - kDesiredWindowHeight) / 2);
-  Move(start_row, start_col, kDesiredWindowHeight, width);
-
-  ColorManager& cm = ColorManager::instance();
-  bg_progress_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_YELLOW);
-  fg_progress_color_pair_ = cm.RegisterColorPair(COLOR_BLACK, COLOR_RED);
+  const int start_row = std::max(0, (max_row - height) / 2);
+  Move(start_row, start_col, height, width);
 }
 
 void ProgressWindow::HandleKeyPress(int key) noexcept {
+  if (key == kEscape && progress_) {
+    progress_->Cancel();
+  }
 }
 
 void ProgressWindow::DisplayImpl() noexcept {
   DrawBorder();
   DrawProgress();
+  DrawStages();
   DrawTimePassed();
 }
 
@@ -58,6 +72,15 @@ void ProgressWindow::DrawProgress() noexcept {
   if (progress_width_ <= 0) {
     return;
   }
+  // Operation finishes not earlier then its least done stage.
+  double done_part = -1;
+  for (Progress::Stage stage : started_stages_) {
+    const double stage_done_part = progress_->GetDonePart(stage);
+    if (stage_done_part >= 0 &&
+        (done_part < 0 || stage_done_part < done_part)) {
+      done_part = stage_done_part;
+    }
+  }
   std::vector<char> buf(progress_width_, ' ');
   int progress_start_x = 2;
   {
@@ -67,18 +90,130 @@ void ProgressWindow::DrawProgress() noexcept {
   }
   {
     WithColor fg(window_, fg_progress_color_pair_);
-    buf.resize(kSliderWidth);
-    mvwaddnstr(
-        window_.get(), kProgressRow,
-        progress_start_x + phase_, buf.data(), buf.size());
+    if (done_part >= 0) {
+      buf.resize(static_cast<size_t>(done_part * progress_width_));
+      mvwaddnstr(
+          window_.get(), kProgressRow,
+          progress_start_x, buf.data(), buf.size());
+    } else {
+      buf.resize(kSliderWidth);
+      mvwaddnstr(
+          window_.get(), kProgressRow,
+          progress_start_x + phase_, buf.data(), buf.size());
+    }
+  }
+}
+
+void ProgressWindow::DrawStages() noexcept {
+  // Stage, that is expected to finish last, limits the whole operation.
+  std::optional<Progress::Stage> slowest_stage;
+  double max_seconds_left = -1;
+  for (Progress::Stage stage : started_stages_) {
+    const double seconds_left = GetSecondsLeft(stage);
+    if (progress_->running_tasks_count(stage) > 0 &&
+        seconds_left > max_seconds_left) {
+      max_seconds_left = seconds_left;
+      slowest_stage = stage;
+    }
+  }
+  const auto now = std::chrono::steady_clock::now();
+  int row = kTextRow;
+  for (Progress::Stage stage : started_stages_) {
+    const StageStart& start = *stage_starts_[static_cast<size_t>(stage)];
+    const double seconds = std::chrono::duration<double>(
+        now - start.time).count();
+    std::string text = boost::str(boost::format("%1%%2$-13s %3$2d tasks") %
+        (stage == slowest_stage ? '>' : ' ') %
+        Progress::StageName(stage) %
+        progress_->running_tasks_count(stage));
+    if (const double done_part = progress_->GetDonePart(stage);
+        done_part >= 0) {
+      text += boost::str(boost::format(" %1$3d%%") %
+          static_cast<int>(done_part * 100));
+    }
+    if (seconds > 0) {
+      const uint64_t done_bytes = progress_->done_bytes(stage);
+      if (done_bytes > 0) {
+        text += boost::str(boost::format(" %1$7.1f MB/s") %
+            ((done_bytes - start.done_bytes) / seconds / (1024 * 1024)));
+      }
+      const uint64_t done_records = progress_->done_records(stage);
+      if (done_records > 0) {
+        text += boost::str(boost::format(" %1$9d rec/s") %
+            static_cast<uint64_t>(
+                (done_records - start.done_records) / seconds));
+      }
+    }
+    // Padding erases text, left from previous drawing.
+    text.resize(std::max(0, num_columns_ - 4), ' ');
+    mvwaddstr(window_.get(), row, 2, text.c_str());
+    ++row;
   }
 }
 
 void ProgressWindow::DrawTimePassed() noexcept {
-  const std::string text = boost::str(
+  std::string text = boost::str(
       boost::format("%1% sec. passed") % passed_sec_);
-  int start_x = std::max(0, num_columns_ - static_cast<int>(text.size())) / 2;
-  mvwaddstr(window_.get(), kTextRow, start_x, text.c_str());
+  if (progress_ && progress_->is_cancelled()) {
+    text += ", cancelling...";
+  }
+  double max_seconds_left = -1;
+  for (Progress::Stage stage : started_stages_) {
+    if (progress_->running_tasks_count(stage) > 0) {
+      max_seconds_left = std::max(max_seconds_left, GetSecondsLeft(stage));
+    }
+  }
+  if (max_seconds_left >= 0 && !progress_->is_cancelled()) {
+    text += boost::str(boost::format(", about %1% sec. left") %
+        static_cast<int>(max_seconds_left + 0.5));
+  }
+  const int row = kTextRow + started_stages_.size();
+  // Padding erases text, left from previous drawing.
+  const int width = std::max(0, num_columns_ - 2);
+  const int padding = std::max(0, width - static_cast<int>(text.size())) / 2;
+  text.insert(0, padding, ' ');
+  text.resize(width, ' ');
+  mvwaddstr(window_.get(), row, 1, text.c_str());
+}
+
+void ProgressWindow::UpdateStartedStages() noexcept {
+  if (!progress_) {
+    return;
+  }
+  bool stages_added = false;
+  for (size_t i = 0; i < Progress::kStagesCount; ++i) {
+    const Progress::Stage stage = static_cast<Progress::Stage>(i);
+    if (stage_starts_[i] || !progress_->is_started(stage)) {
+      continue;
+    }
+    StageStart& start = stage_starts_[i].emplace();
+    start.time = std::chrono::steady_clock::now();
+    start.done_bytes = progress_->done_bytes(stage);
+    start.done_records = progress_->done_records(stage);
+    start.done_part = std::max(0.0, progress_->GetDonePart(stage));
+    stages_added = true;
+  }
+  if (!stages_added) {
+    return;
+  }
+  // Stages are shown in order of pipeline.
+  started_stages_.clear();
+  for (size_t i = 0; i < Progress::kStagesCount; ++i) {
+    if (stage_starts_[i]) {
+      started_stages_.push_back(static_cast<Progress::Stage>(i));
+    }
+  }
+}
+
+double ProgressWindow::GetSecondsLeft(Progress::Stage stage) const noexcept {
+  const StageStart& start = *stage_starts_[static_cast<size_t>(stage)];
+  const double done_part = progress_->GetDonePart(stage);
+  const double seconds = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start.time).count();
+  if (done_part < 0 || seconds <= 0 || done_part <= start.done_part) {
+    return -1;
+  }
+  return (1 - done_part) * seconds / (done_part - start.done_part);
 }
 
 void ProgressWindow::DrawBorder() noexcept {
@@ -91,8 +226,12 @@ void ProgressWindow::DrawBorder() noexcept {
 void ProgressWindow::PostSync() noexcept {
   Display();
   const auto start_time = std::chrono::steady_clock::now();
+  // Keys are polled instead of sleeping, so user may cancel progress.
+  timeout(kRefreshIntervalMs);
   while (!is_ready_callback_()) {
-    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    if (const int key = getch(); key != ERR) {
+      HandleKeyPress(key);
+    }
     phase_ = phase_ + direction_;
     if (phase_ + kSliderWidth >= progress_width_) {
       direction_ = -1;
@@ -103,10 +242,18 @@ void ProgressWindow::PostSync() noexcept {
     }
     passed_sec_ = std::chrono::duration_cast<std::chrono::seconds>(
         std::chrono::steady_clock::now() - start_time).count();
+    const size_t shown_stages_count = started_stages_.size();
+    UpdateStartedStages();
+    if (started_stages_.size() != shown_stages_count) {
+      Layout();
+      DrawBorder();
+    }
     DrawProgress();
+    DrawStages();
     DrawTimePassed();
     wrefresh(window_.get());
   }
+  timeout(-1);
 }
 
 }  // namespace oko
@@ -3,9 +3,16 @@
 // found in the LICENSE file.
 
 #pragma once
+#include <chrono>
 #include <functional>
+#include <future>
+#include <optional>
 #include <string>
+#include <utility>
+#include <vector>
 
+#include "viewer/progress.h"
+#include "viewer/thread_pool.h"
 #include "viewer/ui/window.h"
 
 namespace oko {
@@ -14,19 +21,44 @@ class ProgressWindow : public Window {
  public:
   using IsReadyCallback = std::function<bool()>;
 
-  ProgressWindow(const std::string& title, IsReadyCallback cb) noexcept;
+  // If |progress| is not nullptr, done part, throughput and estimated
+  // time of each its started stage are shown, and Esc cancels it.
+  // Otherwise only time passed is shown. Window is shown until |cb|
+  // returns true, also after cancellation.
+  ProgressWindow(
+      const std::string& title,
+      IsReadyCallback cb,
+      Progress* progress) noexcept;
 
   void PostSync() noexcept;
 
  private:
+  // Values of stage counters, when stage was seen started first time.
+  struct StageStart {
+    std::chrono::steady_clock::time_point time;
+    uint64_t done_bytes = 0;
+    uint64_t done_records = 0;
+    double done_part = 0;
+  };
+
   void HandleKeyPress(int key) noexcept override;
   void DisplayImpl() noexcept override;
   void DrawBorder() noexcept;
   void DrawProgress() noexcept;
   void DrawTimePassed() noexcept;
+  void DrawStages() noexcept;
+  // Picks up newly started stages, and grows window to show them.
+  void UpdateStartedStages() noexcept;
+  // Returns estimated seconds until |stage| finishes, or negative value
+  // if it is unknown.
+  double GetSecondsLeft(Progress::Stage stage) const noexcept;
+  void Layout() noexcept;
 
   const std::string title_;
   const IsReadyCallback is_ready_callback_;
+  Progress* const progress_;
+  std::vector<Progress::Stage> started_stages_;
+  std::optional<StageStart> stage_starts_[Progress::kStagesCount];
   int phase_ = 0;
   int direction_ = 1;
   int passed_sec_ = 0;
@@ -35,4 +67,29 @@ class ProgressWindow : public Window {
   int fg_progress_color_pair_ = 0;
 };
 
+// Calls |func(Progress*)| on thread pool and returns its result. If |func|
+// does not finish quickly, shows progress window with |title| until it
+// finishes. |func| should check whether user cancelled the progress.
+template<typename Func>
+auto RunWithProgress(const std::string& title, Func func) noexcept {
+  Progress progress;
+  auto result = ThreadPool::instance().Submit(
+      TaskPriority::kInteractive,
+      [&progress, func = std::move(func)] {
+        return func(&progress);
+      });
+  if (result.wait_for(std::chrono::milliseconds(100)) !=
+          std::future_status::ready) {
+    ProgressWindow window(
+        title,
+        [&result] {
+          return result.wait_for(std::chrono::seconds(0)) ==
+              std::future_status::ready;
+        },
+        &progress);
+    window.PostSync();
+  }
+  return result.get();
+}
+
 }  // namespace oko
@@ -8,6 +8,7 @@
 #include <boost/format.hpp>
 #include <utility>
 
+#include "viewer/thread_pool.h"
 #include "viewer/ui/color_manager.h"
 #include "viewer/ui/ncurses_helpers.h"
 
@@ -30,8 +31,30 @@ void StatusWindow::DisplayImpl() noexcept {
   const int max_x = getmaxx(window_.get());
 
   // Right-justify total records text.
-  const std::string total_records_text = boost::str(
-      boost::format(" %1% records") % app_model_->unfiltered_records_count());
+  std::string total_records_text = app_model_->is_parsing() ?
+      boost::str(boost::format(" parsing... %1% records") %
+          app_model_->parsed_records_count()) :
+      boost::str(boost::format(" %1% records") %
+          app_model_->unfiltered_records_count());
+  if (app_model_->is_indexing()) {
+    total_records_text = " indexing..." + total_records_text;
+  }
+  if (app_model_->is_searching()) {
+    total_records_text = " searching..." + total_records_text;
+  }
+  if (app_model_->has_search_hits()) {
+    total_records_text = boost::str(boost::format(" match %1%/%2%") %
+        app_model_->search_hits_up_to_selected() %
+        app_model_->search_hits_count()) + total_records_text;
+  } else if (app_model_->is_finding_search_hits()) {
+    total_records_text = " counting matches..." + total_records_text;
+  }
+  const ThreadPool::Stats pool_stats = ThreadPool::instance().GetStats();
+  if (pool_stats.busy_threads_count > 0) {
+    total_records_text = boost::str(boost::format(" cpu %1%%%") %
+        static_cast<int>(pool_stats.utilization * 100)) +
+        total_records_text;
+  }
   const int total_records_x = std::max<int>(
       0, max_x - total_records_text.size());
 
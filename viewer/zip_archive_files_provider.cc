@@ -6,6 +6,7 @@
 
 #include <cstdlib>
 #include <fstream>
+#include <mutex>
 #include <utility>
 
 #include "viewer/error_codes.h"
@@ -76,16 +77,19 @@ outcome::std_result<std::vector<char>>
   return buf;
 }
 
-outcome::std_result<std::unique_ptr<LogFile>>
+outcome::std_result<std::filesystem::path>
     ZipArchiveFilesProvider::FetchLog(
-        const std::string& log_file_name) noexcept {
+        const std::string& log_file_name,
+        Progress* progress) noexcept {
   auto it = name_to_index_.find(log_file_name);
   if (it == name_to_index_.end()) {
     assert(false);
     std::abort();
   }
+  std::unique_lock<std::mutex> zip_file_lock(zip_file_mutex_);
   outcome::std_result<std::vector<char>> compressed_data_buf =
       ReadCompressedData(it->second);
+  zip_file_lock.unlock();
   if (!compressed_data_buf) {
     return compressed_data_buf.error();
   }
@@ -101,42 +105,72 @@ outcome::std_result<std::unique_ptr<LogFile>>
 
   std::filesystem::path result_path =
       maybe_cache_directory_path.value() / log_file_name;
-  std::error_code ec;
-  if (std::filesystem::exists(result_path, ec) && !ec) {
-    return CreateFileForPath(result_path);
+  // Fetching from archive is unpacking of the file.
+  ProgressStage fetching(progress, Progress::Stage::kFetching);
+  const zip_uint64_t entry_index = it->second;
+  outcome::std_result<bool> maybe_unpacked =
+      cache_manager_->GetOrCreateFile(
+          result_path,
+          progress,
+          [this, entry_index, &fetching](
+              const std::filesystem::path& tmp_file_path) {
+            return UnpackFile(entry_index, tmp_file_path, &fetching);
+          });
+  if (!maybe_unpacked) {
+    return maybe_unpacked.error();
   }
+  if (!maybe_unpacked.value()) {
+    std::error_code ec;
+    const uint64_t file_size = std::filesystem::file_size(result_path, ec);
+    if (!ec) {
+      fetching.AddDoneBytes(file_size);
+    }
+  }
+  return result_path;
+}
 
+std::error_code ZipArchiveFilesProvider::UnpackFile(
+    zip_uint64_t entry_index,
+    const std::filesystem::path& dst_file_path,
+    ProgressStage* fetching) noexcept {
+  // Held until decompressed data is written.
+  std::lock_guard<std::mutex> zip_file_lock(zip_file_mutex_);
   std::unique_ptr<zip_file_t, int(*)(zip_file_t*)> zip_file(
-      zip_fopen_index(zip_file_.get(), it->second, 0),
+      zip_fopen_index(zip_file_.get(), entry_index, 0),
       &zip_fclose);
   if (!zip_file) {
     return ErrorCodes::kFileFormatCorrupted;
   }
-  std::filesystem::create_directories(result_path.parent_path(), ec);
-  if (ec) {
-    return ec;
+  std::ofstream dst_file(
+      dst_file_path,
+      std::ios::out | std::ios::binary | std::ios::trunc);
+  if (!dst_file.is_open()) {
+    return std::error_code(errno, std::generic_category());
   }
-
-  std::filesystem::path tmp_file_path = result_path;
-  tmp_file_path.concat(".tmp");
-  {
-    std::ofstream dst_file(
-        tmp_file_path,
-        std::ios::out | std::ios::binary | std::ios::trunc);
-    if (!dst_file.is_open()) {
-      return std::error_code(errno, std::generic_category());
+  // On error incomplete file is removed by |CacheDirectoriesManager|.
+  std::vector<char> buf(4096);
+  while (true) {
+    if (fetching->is_cancelled()) {
+      return ErrorCodes::kCancelled;
     }
-    std::vector<char> buf(4096);
-    while (true) {
-      auto result = zip_fread(zip_file.get(), buf.data(), buf.size());
-      if (result <= 0) {
-        break;
-      }
-      dst_file.write(buf.data(), result);
+    auto result = zip_fread(zip_file.get(), buf.data(), buf.size());
+    if (result < 0) {
+      // E.g. truncated entry or CRC mismatch.
+      return ErrorCodes::kFileFormatCorrupted;
+    }
+    if (result == 0) {
+      break;
     }
+    if (!dst_file.write(buf.data(), result)) {
+      return ErrorCodes::kFailedWriteFile;
+    }
+    fetching->AddDoneBytes(result);
+  }
+  dst_file.close();
+  if (!dst_file) {
+    return ErrorCodes::kFailedWriteFile;
   }
-  std::filesystem::rename(tmp_file_path, result_path);
-  return CreateFileForPath(result_path);
+  return std::error_code();
 }
 
 }  // namespace oko
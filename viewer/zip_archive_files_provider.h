@@ -8,6 +8,7 @@
 
 #include <filesystem>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -26,12 +27,20 @@ class ZipArchiveFilesProvider : public LogFilesProvider {
   outcome::std_result<std::vector<LogFileInfo>>
       GetLogFileInfos() noexcept override;
 
-  outcome::std_result<std::unique_ptr<LogFile>> FetchLog(
-      const std::string& log_file_name) noexcept override;
+  outcome::std_result<std::filesystem::path> FetchLog(
+      const std::string& log_file_name,
+      Progress* progress) noexcept override;
 
  private:
   outcome::std_result<std::vector<char>>
       ReadCompressedData(zip_uint64_t entry_index) noexcept;
+  // Unpacks entry to |dst_file_path|, reporting it to |fetching|.
+  std::error_code UnpackFile(
+      zip_uint64_t entry_index,
+      const std::filesystem::path& dst_file_path,
+      ProgressStage* fetching) noexcept;
+  // libzip archive can not be used by several threads at once.
+  std::mutex zip_file_mutex_;
   std::unique_ptr<zip_t, int(*)(zip_t*)> zip_file_;
   std::unordered_map<std::string, zip_uint64_t> name_to_index_;
 };
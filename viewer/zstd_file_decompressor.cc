@@ -29,7 +29,8 @@ std::optional<std::string> ZstdFileDecompressor::FileNameAfterDecompression(
 
 std::error_code ZstdFileDecompressor::Decompress(
     const std::filesystem::path& src_file_path,
-    const std::filesystem::path& dst_file_path) noexcept {
+    const std::filesystem::path& dst_file_path,
+    Progress* progress) noexcept {
   std::ifstream src_file(src_file_path, std::ios::in | std::ios::binary);
   if (!src_file.is_open()) {
     return std::error_code(errno, std::generic_category());
@@ -46,17 +47,29 @@ std::error_code ZstdFileDecompressor::Decompress(
   if (!decompressor) {
     return ErrorCodes::kDecompressError;
   }
+  std::error_code ec;
+  const uint64_t src_file_size = std::filesystem::file_size(
+      src_file_path, ec);
+  if (ec) {
+    return ec;
+  }
+  ProgressStage decompressing(progress, Progress::Stage::kDecompressing);
+  decompressing.AddTotalBytes(src_file_size);
   size_t const init_result = ZSTD_initDStream(decompressor.get());
   std::vector<char> in_buffer(ZSTD_DStreamInSize());
   std::vector<char> out_buffer(ZSTD_DStreamOutSize());
   size_t next_input_block_size = init_result;
   while (next_input_block_size > 0) {
+    if (decompressing.is_cancelled()) {
+      return ErrorCodes::kCancelled;
+    }
     in_buffer.resize(std::max(next_input_block_size, in_buffer.size()));
     src_file.read(in_buffer.data(), next_input_block_size);
     size_t bytes_read = src_file.gcount();
     if (bytes_read != next_input_block_size) {
       return ErrorCodes::kDecompressError;
     }
+    decompressing.AddDoneBytes(bytes_read);
     ZSTD_inBuffer input = { in_buffer.data(), bytes_read, 0 };
     while (input.pos < input.size) {
       ZSTD_outBuffer output = { out_buffer.data(), out_buffer.size(), 0 };